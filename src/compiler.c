@@ -2,17 +2,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "compiler.h"
 #include "ram.h"
 #include "scanner.h"
 #include "value.h"
+#include "mem.h"
 #include "object.h"
+#include "number.h"
+#include "optimize.h"
 #include "vm.h"
 #include "hint.h"
+#include "table.h"
 
-#define NUM_MAX 16
-#define MAX_CLAUSE 30
+extern VM vm;
+
+#define DENSE_FILL 2     // A switch range may hold this many slots per case.
+#define INLINE_MAX 32   // Bytes of a leaf body that --inline splices.
 
 typedef struct {
     Token previous;
@@ -21,9 +28,11 @@ typedef struct {
 } Parser;
 
 typedef struct {
-    Token local_variable_name;
+    ObjString* name;    // Interned, so names compare by pointer.
     int scope_depth;
     bool need_capture;
+    bool reassigned;    // Assigned after its declaration, or captured before it.
+    int shadowed;       // The local with the same name this one hides, or -1.
 } Local;
 
 typedef struct {
@@ -31,14 +40,27 @@ typedef struct {
     bool is_local;
 } UpValue;
 
+// A local captured by an 'OP_CLOSURE' of this function, which is told
+// whether to copy it once the local's scope ends.
+typedef struct {
+    int local;      // -1 once decided.
+    int operand;    // Offset of the capture kind byte.
+} Capture;
+
 // For each function.
 typedef struct Compiler{
     ObjFunction* function;
     Local local[UINT8_MAX + 1];
     int local_count;
+    Table local_names;  // Name -> index of its innermost local.
     UpValue upvalue[UINT8_MAX + 1];
     int scope_depth;
     struct Compiler* enclosing;
+    LazyBody* lazy;     // Upvalue names of a body compiled on its first call.
+    Capture* captures;
+    int capture_count;
+    int capture_capacity;
+    int last_global_get;    // Offset of the latest 'OP_GET_GLOBAL', or -1.
 } Compiler;
 
 typedef enum {
@@ -48,9 +70,13 @@ typedef enum {
     PREC_AND,         // and
     PREC_EQUALITY,    // == !=
     PREC_COMPARISON,  // < > <= >=
+    PREC_BIT_OR,      // |
+    PREC_BIT_XOR,     // ^
+    PREC_BIT_AND,     // &
+    PREC_SHIFT,       // << >>
     PREC_TERM,        // + -
-    PREC_FACTOR,      // * /
-    PREC_UNARY,       // ! -
+    PREC_FACTOR,      // * / %
+    PREC_UNARY,       // ! - ~
     PREC_CALL,        // . ()
     PREC_PRIMARY
 } Precedence;
@@ -65,17 +91,29 @@ typedef struct {
 static Parser parser;
 static Ram* current_ram = NULL;
 static Compiler* current_stream = NULL;
+static Table inline_candidates;     // Global name -> leaf function, with --inline.
 
-static void beginCompile(Compiler* compiler, ObjString* func_name, FunctionType type) {
-    compiler->function = allocateObjFunction(type);
-    compiler->function->func_name = func_name;
+static void beginFunction(Compiler* compiler, ObjFunction* function) {
+    compiler->function = function;
+    compiler->lazy = NULL;
     compiler->local_count = 0; 
+    initTable(&compiler->local_names);
+    compiler->captures = NULL;
+    compiler->capture_count = 0;
+    compiler->capture_capacity = 0;
+    compiler->last_global_get = -1;
     compiler->scope_depth = 0;
     compiler->enclosing = current_stream;
     current_stream = compiler;
     current_ram = &(current_stream->function->ram);
 }
 
+static void beginCompile(Compiler* compiler, ObjString* func_name, FunctionType type) {
+    ObjFunction* function = allocateObjFunction(type);
+    function->func_name = func_name;
+    beginFunction(compiler, function);
+}
+
 static void errorComile(const char* mes) {
     redHint("[error] at ");
     printf("[%d]: \'", parser.previous.line);
@@ -98,11 +136,21 @@ static void advance() {
 }
 
 static void emitByte(uint8_t op_code) {
-    writeCode(current_ram, op_code);
+    writeCode(current_ram, op_code, parser.previous.line);
+}
+
+static uint8_t makeConstant(Value val) {
+    int index = addConstant(current_ram, val);
+    if(index > UINT8_MAX) {
+        errorComile("Too many constants in one function.\n");
+        return 0;
+    }
+    return (uint8_t)index;
 }
 
 static void emitConstant(Value val) {
-    writeConstant(current_ram, val);
+    emitByte(OP_CONSTANT);
+    emitByte(makeConstant(val));
 }
 
 static void consume(TokenType type, const char* mes) {
@@ -118,11 +166,27 @@ static void consume(TokenType type, const char* mes) {
 }
 
 static void expression();
+static void finishCaptures(int index);
 static ObjFunction* endCompile() {
     emitByte(OP_NIL);
     emitByte(OP_RETURN);
 
+    for(int i = current_stream->local_count - 1; i >= 0; i--) {
+        finishCaptures(i);
+    }
+    if(current_stream->captures != NULL) {
+        FREE(current_stream->captures, "free compiler->captures\n");
+    }
+
     ObjFunction* function = current_stream->function;
+    if(!parser.had_error) {
+        threadJumps(&function->ram);
+    }
+    if(vm.register_ops && !parser.had_error) {
+        fuseRegisterOps(&function->ram);
+    }
+    initGlobalCache(&function->ram);
+    freeTable(&current_stream->local_names);
     current_stream = current_stream->enclosing;
     if(current_stream != NULL) {
         current_ram = &(current_stream->function->ram);
@@ -140,6 +204,9 @@ static void variable();
 static void and_();
 static void or_();
 static void call();
+static void list();
+static void subscript();
+static void map();
 static ParseRule rules[] = {
     [TOKEN_IDENTIFIER]      = {variable,    NULL,       PREC_NONE},
     [TOKEN_NUMBER]          = {number,      NULL,       PREC_NONE},
@@ -151,6 +218,13 @@ static ParseRule rules[] = {
     [TOKEN_SUBTRACT]        = {unary,       binary,     PREC_TERM},
     [TOKEN_MULTIPLY]        = {NULL,        binary,     PREC_FACTOR},
     [TOKEN_DIVIDE]          = {NULL,        binary,     PREC_FACTOR},
+    [TOKEN_MODULO]          = {NULL,        binary,     PREC_FACTOR},
+    [TOKEN_BIT_AND]         = {NULL,        binary,     PREC_BIT_AND},
+    [TOKEN_BIT_OR]          = {NULL,        binary,     PREC_BIT_OR},
+    [TOKEN_BIT_XOR]         = {NULL,        binary,     PREC_BIT_XOR},
+    [TOKEN_BIT_NOT]         = {unary,       NULL,       PREC_NONE},
+    [TOKEN_SHIFT_LEFT]      = {NULL,        binary,     PREC_SHIFT},
+    [TOKEN_SHIFT_RIGHT]     = {NULL,        binary,     PREC_SHIFT},
     [TOKEN_LEFT_PAREN]      = {group,       call,       PREC_CALL},
     [TOKEN_RIGHT_PAREN]     = {NULL,        NULL,       PREC_NONE},
     [TOKEN_BANG]            = {unary,       NULL,       PREC_NONE},
@@ -160,8 +234,12 @@ static ParseRule rules[] = {
     [TOKEN_LESS]            = {NULL,        binary,     PREC_COMPARISON},
     [TOKEN_GREATER_EQUAL]   = {NULL,        binary,     PREC_COMPARISON},
     [TOKEN_LESS_EQUAL]      = {NULL,        binary,     PREC_COMPARISON},
+    [TOKEN_LEFT_BRACKET]    = {list,        subscript,  PREC_CALL},
+    [TOKEN_RIGHT_BRACKET]   = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_COMMA]           = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_COLON]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_EQUAL]           = {NULL,        NULL,       PREC_NONE},
-    [TOKEN_LEFT_BRACE]      = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_LEFT_BRACE]      = {map,         NULL,       PREC_NONE},
     [TOKEN_RIGHT_BRACE]     = {NULL,        NULL,       PREC_NONE},
     [TOKEN_PRINT]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_VAR]             = {NULL,        NULL,       PREC_NONE},
@@ -171,8 +249,14 @@ static ParseRule rules[] = {
     [TOKEN_AND]             = {NULL,        and_,       PREC_AND},
     [TOKEN_OR]              = {NULL,        or_,        PREC_OR},
     [TOKEN_WHILE]           = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_FOR]             = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_IN]              = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_DOT_DOT]         = {NULL,        NULL,       PREC_NONE},
     [TOKEN_FUNC]            = {NULL,        NULL,       PREC_NONE},
     [TOKEN_RETURN]          = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_SWITCH]          = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_CASE]            = {NULL,        NULL,       PREC_NONE},
+    [TOKEN_DEFAULT]         = {NULL,        NULL,       PREC_NONE},
     [TOKEN_SEMICOLON]       = {NULL,        NULL,       PREC_NONE},
     [TOKEN_ERROR]           = {NULL,        NULL,       PREC_NONE},
     [TOKEN_EOF]             = {NULL,        NULL,       PREC_NONE},
@@ -208,19 +292,19 @@ static void literal() {
     }
 }
 
-static void number() {
+static Value numberValue() {
+    const char* chars = parser.previous.initial;
     int length = parser.previous.length;
-    if(length >= NUM_MAX) {
-        // redHint("The length of the number is overflow.\n");
-        errorComile("The length of the number is overflow.\n");
-        return;
+    // Without a fraction it is an 'INT', unless it doesn't fit one.
+    int64_t integer;
+    if(memchr(chars, '.', length) == NULL && parseInteger(chars, length, &integer)) {
+        return VALUE_INT(integer);
     }
+    return VALUE_NUMBER(parseNumber(chars, length));
+}
 
-    char num[NUM_MAX];
-    memcpy(num, parser.previous.initial, length);
-    num[length] = '\0';
-    Value val = VALUE_NUMBER(atof(num));
-    emitConstant(val);
+static void number() {
+    emitConstant(numberValue());
 }
 
 static void unary() {
@@ -240,6 +324,10 @@ static void unary() {
             emitByte(OP_NOT);
             break;
         }
+        case TOKEN_BIT_NOT: {
+            emitByte(OP_BIT_NOT);
+            break;
+        }
         default: {
             // redHint("Unknown Token.\n");
             errorComile("Unknown Token.\n");
@@ -274,6 +362,30 @@ static void binary() {
             emitByte(OP_DIVIDE);
             break;
         }
+        case TOKEN_MODULO: {
+            emitByte(OP_MODULO);
+            break;
+        }
+        case TOKEN_BIT_AND: {
+            emitByte(OP_BIT_AND);
+            break;
+        }
+        case TOKEN_BIT_OR: {
+            emitByte(OP_BIT_OR);
+            break;
+        }
+        case TOKEN_BIT_XOR: {
+            emitByte(OP_BIT_XOR);
+            break;
+        }
+        case TOKEN_SHIFT_LEFT: {
+            emitByte(OP_SHIFT_LEFT);
+            break;
+        }
+        case TOKEN_SHIFT_RIGHT: {
+            emitByte(OP_SHIFT_RIGHT);
+            break;
+        }
         case TOKEN_EQUAL_EQUAL: {
             emitByte(OP_EQUAL);
             break;
@@ -329,6 +441,7 @@ static void expression() {
 }
 
 static void emitJump(OpCode code);
+static void patchJump(int operand);
 static void and_() {
     emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
@@ -352,22 +465,29 @@ static void or_() {
     current_ram->code[begin_jump - 2] = (uint8_t)(will_jump >> 8);
 }
 
+static ObjString* identifierName(Token* token) {
+    return allocateObjString(token->initial, token->length);
+}
+
+// Return the innermost local called 'name' in 'stream', or -1.
+static int findLocal(Compiler* stream, ObjString* name) {
+    Value index;
+    if(!tableGet(&stream->local_names, name, &index)) {
+        return -1;
+    }
+    return (int)AS_NUMBER(index);
+}
+
 static int getLocal(Token* token) {
     if(current_stream->scope_depth == 0) {
         return -1;
     }
 
-    for(int i = current_stream->local_count - 1; i >= 0; i--) {
-        Token* name = &current_stream->local[i].local_variable_name;
-        if(current_stream->local[i].scope_depth <= current_stream->scope_depth \
-                && strncmp(name->initial, token->initial, name->length) == 0) {
-            if(current_stream->local[i].scope_depth == -1) {
-                errorComile("Undefined local variable.\n");
-            }
-            return i;
-        }
+    int index = findLocal(current_stream, identifierName(token));
+    if(index != -1 && current_stream->local[index].scope_depth == -1) {
+        errorComile("Undefined local variable.\n");
     }
-    return -1;
+    return index;
 }
 
 static int addUpvalue(Compiler* stream, int index, bool is_local) {
@@ -378,8 +498,8 @@ static int addUpvalue(Compiler* stream, int index, bool is_local) {
             return i;
         }
     }
-    current_stream->upvalue[*upvalue_count].index = index;
-    current_stream->upvalue[*upvalue_count].is_local = is_local;
+    stream->upvalue[*upvalue_count].index = index;
+    stream->upvalue[*upvalue_count].is_local = is_local;
     (*upvalue_count)++;
     return (*upvalue_count) - 1;
 }
@@ -389,10 +509,48 @@ static int getUpValueFromEnclosing(Compiler* stream, Token* token) {
         return -1;
     }
 
-    for(int i = 0; i < stream->local_count; i++) {
-        Token* local_name = &stream->local[i].local_variable_name;
-        if(local_name->length == token->length && strncmp(local_name->initial, token->initial, local_name->length) == 0) {
-            stream->local[i].need_capture = true;
+    int index = findLocal(stream, identifierName(token));
+    if(index != -1) {
+        stream->local[index].need_capture = true;
+        // A function capturing itself is created before its local is set.
+        if(stream->local[index].scope_depth == -1) {
+            stream->local[index].reassigned = true;
+        }
+    }
+    return index;
+}
+
+// Follow an upvalue of 'stream' down to the local it captures.
+static void markUpvalueAssigned(Compiler* stream, int upvalue) {
+    Compiler* enclosing = stream->enclosing;
+    if(enclosing == NULL) return;   // A lazy body, skimming saw the assignment.
+    if(stream->upvalue[upvalue].is_local) {
+        enclosing->local[stream->upvalue[upvalue].index].reassigned = true;
+    } else {
+        markUpvalueAssigned(enclosing, stream->upvalue[upvalue].index);
+    }
+}
+
+// Skimming can't resolve a body's own locals, so mark every enclosing
+// local with the assigned name.
+static void markNameAssigned(Compiler* stream, Token* token) {
+    ObjString* name = identifierName(token);
+    for(; stream != NULL; stream = stream->enclosing) {
+        int index = findLocal(stream, name);
+        if(index != -1) {
+            stream->local[index].reassigned = true;
+            return;
+        }
+    }
+}
+
+// A lazily compiled body has no enclosing compiler any more, its upvalues
+// were fixed by name when it was skimmed.
+static int getLazyUpvalue(Compiler* stream, Token* token) {
+    if(stream->lazy == NULL) return -1;
+    ObjString* name = identifierName(token);
+    for(int i = 0; i < stream->function->upvalue_count; i++) {
+        if(stream->lazy->upvalue_names[i] == name) {
             return i;
         }
     }
@@ -400,7 +558,8 @@ static int getUpValueFromEnclosing(Compiler* stream, Token* token) {
 }
 
 static int getUpvalue(Compiler* stream, Token* token) {
-    if(stream == NULL || stream->enclosing == NULL) return -1;
+    if(stream == NULL) return -1;
+    if(stream->enclosing == NULL) return getLazyUpvalue(stream, token);
 
     int local = getUpValueFromEnclosing(stream->enclosing, token);
     if(local != -1) {
@@ -433,12 +592,20 @@ static void variable() {
     } 
     else {
         Value val = allocateString(token.initial, token.length);
-        arg = addConstant(current_ram, val);
+        arg = makeConstant(val);
         set_op = OP_SET_GLOBAL;
         get_op = OP_GET_GLOBAL;
     }
 
+    if(get_op == OP_GET_GLOBAL && parser.current.type != TOKEN_EQUAL) {
+        current_stream->last_global_get = current_ram->count;
+    }
     if(match(TOKEN_EQUAL)) {
+        if(set_op == OP_SET_LOCAL) {
+            current_stream->local[arg].reassigned = true;
+        } else if(set_op == OP_SET_UPVALUE) {
+            markUpvalueAssigned(current_stream, arg);
+        }
         expression();
         emitByte(set_op);
     } else {
@@ -464,14 +631,149 @@ static int scanParameters() {
     return arg_num;
 }
 
+// The length of a body that can be spliced into callers, up to its only
+// 'OP_RETURN', or -1. It must be short and straight: no calls, closures,
+// upvalues or jumps, so it can't recurse or need a frame of its own.
+static int inlineLength(ObjFunction* function) {
+    Ram* ram = &function->ram;
+    if(function->upvalue_count > 0) return -1;
+    for(int offset = 0; offset < ram->count && offset <= INLINE_MAX; offset += instructionLength(ram, offset)) {
+        switch(ram->code[offset]) {
+            case OP_CONSTANT: case OP_NIL: case OP_TRUE: case OP_FALSE:
+            case OP_NEGATE: case OP_NOT:
+            case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE:
+            case OP_EQUAL: case OP_GREATER: case OP_LESS:
+            case OP_PRINT: case OP_GET_GLOBAL: case OP_SET_GLOBAL:
+            case OP_GET_LOCAL: case OP_SET_LOCAL:
+            case OP_LIST: case OP_APPEND: case OP_MAP: case OP_INSERT:
+            case OP_GET_INDEX: case OP_SET_INDEX: case OP_POP:
+                break;
+            case OP_RETURN: {
+                // Only the implicit 'nil' return may follow.
+                bool is_last = offset == ram->count - 1 ||
+                               (offset == ram->count - 3 && ram->code[offset + 1] == OP_NIL);
+                return is_last && offset <= INLINE_MAX ? offset : -1;
+            }
+            case OP_CALL:
+            case OP_INLINE_CHECK:
+                // 'vm.inline_base' is a single register, not saved across
+                // calls or nested inline bodies: a body that set it again
+                // would leave its caller's 'OP_GET_ARG's reading the wrong
+                // slots.
+                return -1;
+            default:
+                return -1;
+        }
+    }
+    return -1;
+}
+
+// Copy the body into the current function, its constants are added here
+// and its locals are reached from 'vm.inline_base'.
+static void inlineBody(ObjFunction* callee, int length) {
+    Ram* ram = &callee->ram;
+    for(int offset = 0; offset < length; offset += instructionLength(ram, offset)) {
+        uint8_t op = ram->code[offset];
+        switch(op) {
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+                emitByte(op);
+                emitByte(makeConstant(ram->constants.val[ram->code[offset + 1]]));
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                emitByte(op == OP_GET_LOCAL ? OP_GET_ARG : OP_SET_ARG);
+                emitByte(ram->code[offset + 1]);
+                break;
+            default:
+                for(int i = 0; i < instructionLength(ram, offset); i++) {
+                    emitByte(ram->code[offset + i]);
+                }
+                break;
+        }
+    }
+}
+
+// The leaf function the callee just loaded by name was last bound to.
+static ObjFunction* inlineCandidate() {
+    if(!vm.inline_calls || current_stream->last_global_get != current_ram->count - 2) {
+        return NULL;
+    }
+    Value name = current_ram->constants.val[current_ram->code[current_ram->count - 1]];
+    Value function;
+    if(!tableGet(&inline_candidates, AS_STRING(name), &function)) {
+        return NULL;
+    }
+    return AS_FUNC(function);
+}
+
 static void call() {
+    ObjFunction* inlined = inlineCandidate();
     int arg_num = scanParameters();
+    if(inlined != NULL && arg_num == inlined->arity) {
+        // OP_INLINE_CHECK fn, body, OP_INLINE_RETURN, OP_CALL n
+        // 'OP_INLINE_RETURN' skips the call, which a failed check jumps to.
+        emitByte(OP_INLINE_CHECK);
+        emitByte(makeConstant(VALUE_OBJ(inlined)));
+        emitByte(0xff);
+        emitByte(0xff);
+        int check_jump = current_ram->count - 2;
+        inlineBody(inlined, inlineLength(inlined));
+        emitByte(OP_INLINE_RETURN);
+        patchJump(check_jump);
+        emitByte(OP_CALL);
+        emitByte(arg_num);
+        return;
+    }
     emitByte(OP_CALL);
     emitByte(arg_num);
 }
 
-void justScan(const char* source) {
-    initScanner(source);
+// The capacity operand of OP_LIST is patched once the length is known.
+static void list() {
+    emitByte(OP_LIST);
+    emitByte(0);
+    int capacity_index = current_ram->count - 1;
+    int count = 0;
+    if(parser.current.type != TOKEN_RIGHT_BRACKET) {
+        do {
+            expression();
+            emitByte(OP_APPEND);
+            count++;
+        } while(match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list.\n");
+    current_ram->code[capacity_index] = (uint8_t)(count > UINT8_MAX ? UINT8_MAX : count);
+}
+
+// A '{' in expression position starts a map, a statement '{' is a block.
+static void map() {
+    emitByte(OP_MAP);
+    if(parser.current.type != TOKEN_RIGHT_BRACE) {
+        do {
+            expression();
+            consume(TOKEN_COLON, "Expect ':' after map key.\n");
+            expression();
+            emitByte(OP_INSERT);
+        } while(match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map.\n");
+}
+
+static void subscript() {
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.\n");
+    if(match(TOKEN_EQUAL)) {
+        expression();
+        emitByte(OP_SET_INDEX);
+    } else {
+        emitByte(OP_GET_INDEX);
+    }
+}
+
+void justScan(const char* source, size_t length) {
+    initScanner(source, length);
     while(1) {
         Token token = scanToken();
         if(token.type == TOKEN_EOF) {
@@ -481,6 +783,24 @@ void justScan(const char* source) {
     }
 }
 
+// Scan the whole source without compiling, and report the throughput.
+void benchScan(const char* source, size_t length) {
+    long tokens = 0;
+    clock_t begin = clock();
+    initScanner(source, length);
+    for(;;) {
+        Token token = scanToken();
+        tokens++;
+        if(token.type == TOKEN_EOF) {
+            break;
+        }
+    }
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    if(seconds <= 0) seconds = 1.0 / CLOCKS_PER_SEC;
+    printf("bytes: %zu\ttokens: %ld\ttime: %.3fs\n", length, tokens, seconds);
+    printf("%.0f tokens/s\t%.1f MB/s\n", tokens / seconds, length / seconds / (1024 * 1024));
+}
+
 
 static void printStmt() {
     expression();
@@ -499,33 +819,68 @@ static void addLocal() {
         errorComile("The function local stack is overflow.\n");
     }
     Local* local = &current_stream->local[current_stream->local_count];
-    local->local_variable_name = parser.previous;
+    local->name = identifierName(&parser.previous);
     // current_stream->local[current_stream->local_count].scope_depth = current_stream->scope_depth;
     local->scope_depth = -1;
     local->need_capture = false;
+    local->reassigned = false;
+    local->shadowed = findLocal(current_stream, local->name);
+    tableSet(&current_stream->local_names, local->name, VALUE_NUMBER(current_stream->local_count));
     current_stream->local_count++;
 }
 
+static void addCapture(int local, int operand) {
+    Compiler* stream = current_stream;
+    if(stream->capture_count == stream->capture_capacity) {
+        stream->capture_capacity = GROW_CAPACITY(stream->capture_capacity);
+        stream->captures = GROW_ARRAY(stream->captures, Capture, stream->capture_count, stream->capture_capacity);
+    }
+    stream->captures[stream->capture_count].local = local;
+    stream->captures[stream->capture_count].operand = operand;
+    stream->capture_count++;
+}
+
+// Once a local's scope ends nothing can assign it any more. If nothing
+// did, closures copy its value and it never becomes an open upvalue.
+static void finishCaptures(int index) {
+    Local* local = &current_stream->local[index];
+    bool is_copy = local->need_capture && !local->reassigned;
+    for(int i = 0; i < current_stream->capture_count; i++) {
+        Capture* capture = &current_stream->captures[i];
+        if(capture->local != index) continue;
+        if(is_copy) current_ram->code[capture->operand] = CAPTURE_COPY;
+        capture->local = -1;
+    }
+    if(is_copy) local->need_capture = false;
+}
+
+// Drop the innermost local, and make the one it hid visible again.
+static void removeLocal() {
+    current_stream->local_count--;
+    Local* local = &current_stream->local[current_stream->local_count];
+    if(local->shadowed != -1) {
+        tableSet(&current_stream->local_names, local->name, VALUE_NUMBER(local->shadowed));
+    } else {
+        tableDelete(&current_stream->local_names, local->name);
+    }
+}
+
 static int resolveVariableName() {
     consume(TOKEN_IDENTIFIER, "Expect variable name.\n");
 
     // It's a local variable.
     if(current_stream->scope_depth > 0) {
-        for(int i = current_stream->local_count - 1; i >= 0; i--) {
-            Local* tmp = &current_stream->local[i];
-            if(tmp->scope_depth == current_stream->scope_depth && \
-                    tmp->local_variable_name.length == parser.previous.length && \
-                    strncmp(tmp->local_variable_name.initial, parser.previous.initial, tmp->local_variable_name.length) == 0) {
-                errorComile("The variable has existed.\n");
-                return -1;
-            }
+        int index = findLocal(current_stream, identifierName(&parser.previous));
+        if(index != -1 && current_stream->local[index].scope_depth == current_stream->scope_depth) {
+            errorComile("The variable has existed.\n");
+            return -1;
         }
         addLocal();
         return -1;
     }
 
     // It's a global variable.
-    return addConstant(current_ram, allocateString(parser.previous.initial, parser.previous.length));
+    return makeConstant(allocateString(parser.previous.initial, parser.previous.length));
 }
 
 static void markInit() {
@@ -546,6 +901,7 @@ static void varDeclaration() {
     if(global_var_index == -1) {
         markInit();
     } else {
+        tableDelete(&inline_candidates, AS_STRING(current_ram->constants.val[global_var_index]));
         emitByte(OP_DEFINE_GLOBAL);
         emitByte((uint8_t)global_var_index);
     }
@@ -563,8 +919,9 @@ static void endBlock() {
     for(int i = current_stream->local_count - 1; i >= 0; i--) {
         Local* local = &current_stream->local[i];
         if(local->scope_depth == current_stream->scope_depth) {
+            finishCaptures(i);
             emitByte(local->need_capture == true ? OP_CLOSE_UPVALUE : OP_POP);
-            current_stream->local_count--;
+            removeLocal();
         }
     }
     current_stream->scope_depth--;
@@ -600,22 +957,35 @@ static int ifClause() {
 static void stuffJump(int clause_count, int* clause_to_do) {
     for(int i = 0; i < clause_count; i++) {
         int success_jump = current_ram->count - clause_to_do[i] + 1;
+        if(success_jump > UINT16_MAX) {
+            errorComile("Too much code to jump over.\n");
+        }
         current_ram->code[clause_to_do[i] - 3] = (uint8_t)success_jump;
         current_ram->code[clause_to_do[i] - 2] = (uint8_t)(success_jump >> 8);
     }
 }
 
+// Append 'value' to a growable array of exits.
+static int* addExit(int* exits, int* count, int* capacity, int value) {
+    if(*count == *capacity) {
+        int new_capacity = GROW_CAPACITY(*capacity);
+        exits = GROW_ARRAY(exits, int, *count, new_capacity);
+        *capacity = new_capacity;
+    }
+    exits[(*count)++] = value;
+    return exits;
+}
+
 static void ifStmt() {
     int (*elifClause)() = ifClause;
 
     int clause_count = 0;
-    int clause_to_do[MAX_CLAUSE];
+    int clause_capacity = 0;
+    int* clause_to_do = NULL;
 
-    clause_to_do[clause_count] = ifClause();
-    clause_count++;
+    clause_to_do = addExit(clause_to_do, &clause_count, &clause_capacity, ifClause());
     while(match(TOKEN_ELIF)) {
-        clause_to_do[clause_count] = elifClause();
-        clause_count++; 
+        clause_to_do = addExit(clause_to_do, &clause_count, &clause_capacity, elifClause());
     }
     
     // else clause.
@@ -624,6 +994,127 @@ static void ifStmt() {
     }
 
     stuffJump(clause_count, clause_to_do);
+    FREE(clause_to_do, "free clause_to_do\n");
+}
+
+// A case is a literal, so the table is complete once the switch is compiled.
+static Value caseValue() {
+    bool negate = match(TOKEN_SUBTRACT);
+    if(match(TOKEN_NUMBER)) {
+        Value val = numberValue();
+        if(!negate) return val;
+        return IS_INT(val) ? VALUE_INT(-AS_INT(val)) : VALUE_NUMBER(-AS_NUMBER(val));
+    }
+    if(!negate) {
+        if(match(TOKEN_STRING)) {
+            return allocateString(parser.previous.initial, parser.previous.length);
+        }
+        if(match(TOKEN_TRUE)) return VALUE_BOOLEAN(true);
+        if(match(TOKEN_FALSE)) return VALUE_BOOLEAN(false);
+        if(match(TOKEN_NIL)) return VALUE_NIL;
+    }
+    errorComile("Expect a literal after 'case'.\n");
+    return VALUE_NIL;
+}
+
+static bool isDenseCase(Value val) {
+    if(!IS_NUMERIC(val)) return false;
+    double num = TO_DOUBLE(val);
+    return num >= INT32_MIN && num <= INT32_MAX && num == (int)num;
+}
+
+// Move the integral cases into an array indexed from the lowest one if
+// they fill enough of their range, everything else stays hashed.
+static void layoutJumpTable(ObjJumpTable* table) {
+    Table* sparse = &table->sparse;
+    double low = 0, high = 0;
+    int count = 0;
+    for(int i = tableNext(sparse, -1); i != -1; i = tableNext(sparse, i)) {
+        Value key = sparse->entry[i].key;
+        if(!isDenseCase(key)) continue;
+        double num = TO_DOUBLE(key);
+        if(count == 0 || num < low) low = num;
+        if(count == 0 || num > high) high = num;
+        count++;
+    }
+    if(count == 0 || high - low + 1 > (double)count * DENSE_FILL) return;
+
+    table->low = low;
+    table->dense_count = (int)(high - low) + 1;
+    table->dense = GROW_ARRAY(NULL, int, 0, table->dense_count);
+    for(int i = 0; i < table->dense_count; i++) {
+        table->dense[i] = table->default_target;
+    }
+    Table rest;
+    initTable(&rest);
+    for(int i = tableNext(sparse, -1); i != -1; i = tableNext(sparse, i)) {
+        Entry* entry = &sparse->entry[i];
+        if(isDenseCase(entry->key)) {
+            table->dense[(int)(TO_DOUBLE(entry->key) - low)] = (int)AS_NUMBER(entry->val);
+        } else {
+            tableSetValue(&rest, entry->key, entry->val);
+        }
+    }
+    freeTable(sparse);
+    *sparse = rest;
+}
+
+// switch (value) { case 1, 2: ... case "a": ... default: ... }
+// The value is looked up once by 'OP_JUMP_TABLE', each body then jumps
+// past the switch, there is no fall through.
+static void switchStmt() {
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after switch.\n");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after switch value.\n");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch body.\n");
+
+    ObjJumpTable* table = allocateObjJumpTable();
+    emitByte(OP_JUMP_TABLE);
+    emitByte(makeConstant(VALUE_OBJ(table)));
+    int base = current_ram->count;
+
+    int exit_count = 0;
+    int exit_capacity = 0;
+    int* exits = NULL;
+    while(parser.current.type != TOKEN_RIGHT_BRACE && parser.current.type != TOKEN_EOF) {
+        int target = addJumpTarget(table, current_ram->count - base);
+        if(match(TOKEN_CASE)) {
+            do {
+                Value val = caseValue();
+                if(!tableSetValue(&table->sparse, val, VALUE_NUMBER(target))) {
+                    errorComile("The case is already in the switch.\n");
+                }
+            } while(match(TOKEN_COMMA));
+        } else if(match(TOKEN_DEFAULT)) {
+            if(table->default_target >= 0) {
+                errorComile("A switch can only have one default.\n");
+            }
+            table->default_target = target;
+        } else {
+            errorComile("Expect 'case' or 'default' in switch.\n");
+            break;
+        }
+        consume(TOKEN_COLON, "Expect ':' after case.\n");
+
+        current_stream->scope_depth++;
+        while(parser.current.type != TOKEN_CASE && parser.current.type != TOKEN_DEFAULT &&
+              parser.current.type != TOKEN_RIGHT_BRACE && parser.current.type != TOKEN_EOF) {
+            declaration();
+        }
+        endBlock();
+        emitJump(OP_JUMP);
+        exits = addExit(exits, &exit_count, &exit_capacity, current_ram->count - 2);
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch body.\n");
+
+    if(table->default_target < 0) {
+        table->default_target = addJumpTarget(table, current_ram->count - base);
+    }
+    for(int i = 0; i < exit_count; i++) {
+        patchJump(exits[i]);
+    }
+    if(exits != NULL) FREE(exits, "free switch exits\n");
+    layoutJumpTable(table);
 }
 
 static void whileStmt() {
@@ -635,6 +1126,7 @@ static void whileStmt() {
 
     emitJump(OP_JUMP_IF_FALSE);
     int begin_jump = current_ram->count;
+    emitByte(OP_POP);
     statement();
     emitJump(OP_BACK_JUMP);
     emitByte(OP_POP);
@@ -647,6 +1139,122 @@ static void whileStmt() {
     current_ram->code[end_jump - 2] = (uint8_t)(will_back_jump >> 8);
 }
 
+// Patch the 16-bit operand at 'operand' to jump forward to the current end.
+static void patchJump(int operand) {
+    int will_jump = current_ram->count - operand - 2;
+    if(will_jump > UINT16_MAX) {
+        errorComile("Too much code to jump over.\n");
+    }
+    current_ram->code[operand] = (uint8_t)will_jump;
+    current_ram->code[operand + 1] = (uint8_t)(will_jump >> 8);
+}
+
+static void emitBackJump(int loop_start) {
+    emitByte(OP_BACK_JUMP);
+    int will_back_jump = current_ram->count - loop_start + 2;
+    if(will_back_jump > UINT16_MAX) {
+        errorComile("The loop body is too large.\n");
+    }
+    emitByte((uint8_t)will_back_jump);
+    emitByte((uint8_t)(will_back_jump >> 8));
+}
+
+// for (init; condition; increment) statement
+static void cForStmt() {
+    if(match(TOKEN_SEMICOLON)) {
+        // No initializer.
+    } else if(match(TOKEN_VAR)) {
+        varDeclaration();
+    } else {
+        expressionStmt();
+    }
+
+    int loop_start = current_ram->count;
+    int exit_jump = -1;
+    if(!match(TOKEN_SEMICOLON)) {
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after for condition.\n");
+        emitJump(OP_JUMP_IF_FALSE);
+        exit_jump = current_ram->count - 2;
+        emitByte(OP_POP);
+    }
+
+    if(!match(TOKEN_RIGHT_PAREN)) {
+        emitJump(OP_JUMP);
+        int body_jump = current_ram->count - 2;
+        int increment_start = current_ram->count;
+        expression();
+        emitByte(OP_POP);
+        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.\n");
+        emitBackJump(loop_start);
+        loop_start = increment_start;
+        patchJump(body_jump);
+    }
+
+    statement();
+    emitBackJump(loop_start);
+
+    if(exit_jump != -1) {
+        patchJump(exit_jump);
+        emitByte(OP_POP);
+    }
+}
+
+// for i in begin..end statement
+// The counter and a hidden limit live in two adjacent locals, so one
+// OP_FOR_ITER can step, compare and branch without touching the stack.
+static void rangeForStmt() {
+    consume(TOKEN_IDENTIFIER, "Expect variable name.\n");
+    Token name = parser.previous;
+    consume(TOKEN_IN, "Expect 'in' after for variable.\n");
+    // The range is outside the loop's scope: 'for i in i..n' reads the
+    // outer 'i'. Its two values become the counter and limit slots.
+    expression();
+    consume(TOKEN_DOT_DOT, "Expect '..' in for range.\n");
+    expression();
+    int limit_line = parser.previous.line;
+    parser.previous = name;
+    addLocal();
+    markInit();
+    // OP_FOR_ITER steps the counter in place.
+    current_stream->local[current_stream->local_count - 1].reassigned = true;
+
+    Token limit_name = { TOKEN_IDENTIFIER, "(limit)", 7, limit_line };
+    parser.previous = limit_name;
+    addLocal();
+    markInit();
+    uint8_t counter_slot = (uint8_t)(current_stream->local_count - 2);
+
+    emitByte(OP_FOR_PREP);
+    emitByte(counter_slot);
+    emitByte(0xff);
+    emitByte(0xff);
+    int exit_jump = current_ram->count - 2;
+    int body_start = current_ram->count;
+
+    statement();
+
+    emitByte(OP_FOR_ITER);
+    emitByte(counter_slot);
+    int will_back_jump = current_ram->count - body_start + 2;
+    if(will_back_jump > UINT16_MAX) {
+        errorComile("The loop body is too large.\n");
+    }
+    emitByte((uint8_t)will_back_jump);
+    emitByte((uint8_t)(will_back_jump >> 8));
+    patchJump(exit_jump);
+}
+
+static void forStmt() {
+    current_stream->scope_depth++;
+    if(match(TOKEN_LEFT_PAREN)) {
+        cForStmt();
+    } else {
+        rangeForStmt();
+    }
+    endBlock();
+}
+
 static int argList() {
     int arg_num = 0;
     consume(TOKEN_LEFT_PAREN, "Expect '(' before function parameters declaration.\n");
@@ -661,22 +1269,107 @@ static int argList() {
     return arg_num;
 }
 
+// Skip '(parameters) { body }' without compiling it. Every identifier in
+// the body that resolves to an enclosing local or upvalue becomes an
+// upvalue, since the enclosing compiler is gone when the body is compiled.
+static ObjFunction* skimFunction(ObjString* func_name, UpValue* upvalue) {
+    ObjFunction* function = allocateObjFunction(TYPE_USER);
+    function->func_name = func_name;
+    const char* begin = parser.current.initial;
+    int line = parser.current.line;
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' before function parameters declaration.\n");
+    while(!match(TOKEN_RIGHT_PAREN) && parser.current.type != TOKEN_EOF) {
+        if(match(TOKEN_IDENTIFIER)) {
+            function->arity++;
+        } else {
+            advance();
+        }
+    }
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after function declaration.\n");
+
+    ObjString* upvalue_names[UINT8_MAX + 1];
+    Table seen;
+    initTable(&seen);
+    int depth = 1;
+    while(depth > 0 && parser.current.type != TOKEN_EOF) {
+        advance();
+        if(parser.previous.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if(parser.previous.type == TOKEN_RIGHT_BRACE) {
+            depth--;
+        } else if(parser.previous.type == TOKEN_IDENTIFIER) {
+            if(parser.current.type == TOKEN_EQUAL) {
+                markNameAssigned(current_stream, &parser.previous);
+            }
+            ObjString* name = identifierName(&parser.previous);
+            if(!tableSet(&seen, name, VALUE_NIL)) continue;
+
+            int index = getUpValueFromEnclosing(current_stream, &parser.previous);
+            bool is_local = true;
+            if(index == -1) {
+                index = getUpvalue(current_stream, &parser.previous);
+                is_local = false;
+            }
+            if(index == -1) continue;   // A global.
+            if(function->upvalue_count == UINT8_MAX) {
+                errorComile("Too many upvalues in one function.\n");
+                continue;
+            }
+            upvalue[function->upvalue_count].index = index;
+            upvalue[function->upvalue_count].is_local = is_local;
+            upvalue_names[function->upvalue_count] = name;
+            function->upvalue_count++;
+        }
+    }
+    freeTable(&seen);
+    if(depth > 0) {
+        errorComile("Expect '}' after function body.\n");
+    }
+
+    LazyBody* lazy = (LazyBody*)malloc(sizeof(LazyBody));
+    lazy->source = begin;
+    lazy->length = parser.previous.initial + parser.previous.length - begin;
+    lazy->line = line;
+    lazy->upvalue_names = (ObjString**)malloc(sizeof(ObjString*) * (function->upvalue_count + 1));
+    memcpy(lazy->upvalue_names, upvalue_names, sizeof(ObjString*) * function->upvalue_count);
+    function->lazy = lazy;
+    return function;
+}
+
 static void funcDeclaration() {
     int global_var_index = resolveVariableName();
     ObjString* func_name = allocateObjString(parser.previous.initial, parser.previous.length);
 
     Compiler compiler;
-    beginCompile(&compiler, func_name, TYPE_USER);
-    current_stream->scope_depth++;  // The function can't define a global variable.
-    compiler.function->arity = argList();
-    consume(TOKEN_LEFT_BRACE, "Expect '{' after function declaration.\n");
-    blockStmt();
-    ObjFunction* function = endCompile();
+    ObjFunction* function;
+    if(vm.lazy_compile) {
+        function = skimFunction(func_name, compiler.upvalue);
+    } else {
+        beginCompile(&compiler, func_name, TYPE_USER);
+        current_stream->scope_depth++;  // The function can't define a global variable.
+        compiler.function->arity = argList();
+        consume(TOKEN_LEFT_BRACE, "Expect '{' after function declaration.\n");
+        blockStmt();
+        function = endCompile();
+    }
+
+    // Rebinding the name is caught at run time, this only picks the body.
+    if(global_var_index != -1 && vm.inline_calls) {
+        if(function->lazy == NULL && inlineLength(function) >= 0) {
+            tableSet(&inline_candidates, func_name, VALUE_OBJ(function));
+        } else {
+            tableDelete(&inline_candidates, func_name);
+        }
+    }
 
     emitByte(OP_CLOSURE);
-    emitByte(addConstant(current_ram, VALUE_OBJ(function)));
+    emitByte(makeConstant(VALUE_OBJ(function)));
     for(int i = 0; i < function->upvalue_count; i++) {
-        emitByte(compiler.upvalue[i].is_local ? 1 : 0);
+        if(compiler.upvalue[i].is_local) {
+            addCapture(compiler.upvalue[i].index, current_ram->count);
+        }
+        emitByte(compiler.upvalue[i].is_local ? CAPTURE_LOCAL : CAPTURE_UPVALUE);
         emitByte(compiler.upvalue[i].index);
     }
 
@@ -710,8 +1403,12 @@ static void statement() {
         endBlock();
     } else if(match(TOKEN_IF)) {
         ifStmt();
+    } else if(match(TOKEN_SWITCH)) {
+        switchStmt();
     } else if(match(TOKEN_WHILE)) {
         whileStmt();
+    } else if(match(TOKEN_FOR)) {
+        forStmt();
     } else if(match(TOKEN_RETURN)) {
         returnStmt();
     } else {
@@ -729,8 +1426,10 @@ static void declaration() {
     }
 }
 
-ObjFunction* compile(const char* source) {
-    initScanner(source);
+ObjFunction* compile(const char* source, size_t length) {
+    initScanner(source, length);
+    parser.had_error = false;
+    current_stream = NULL;
 
     Compiler compiler;
     const char* main_func_name = "script";
@@ -745,6 +1444,28 @@ ObjFunction* compile(const char* source) {
 
     consume(TOKEN_EOF, "Not find TOKEN_EOF\n");
     ObjFunction* main_func = endCompile();
+    freeTable(&inline_candidates);
     return parser.had_error == true ? NULL : main_func;
 }
 
+// Compile a body skimmed by 'skimFunction' into the same function object,
+// the closures made from it already hold the right upvalues.
+bool compileLazy(ObjFunction* function) {
+    LazyBody* lazy = function->lazy;
+    resumeScanner(lazy->source, lazy->length, lazy->line);
+    parser.had_error = false;
+    current_stream = NULL;
+
+    Compiler compiler;
+    beginFunction(&compiler, function);
+    compiler.lazy = lazy;
+    current_stream->scope_depth++;
+    advance();
+    argList();
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after function declaration.\n");
+    blockStmt();
+    endCompile();
+
+    freeLazyBody(function);
+    return !parser.had_error;
+}
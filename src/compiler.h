@@ -2,9 +2,12 @@
 #define __COMPILER_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "value.h"
 
-ObjFunction* compile(const char* source);
-void justScan(const char* source);
+ObjFunction* compile(const char* source, size_t length);
+bool compileLazy(ObjFunction* function);
+void justScan(const char* source, size_t length);
+void benchScan(const char* source, size_t length);
 
 #endif // !__COMPILER_H__
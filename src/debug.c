@@ -26,6 +26,15 @@ static int variableInstruction(const char* mes, Ram* ram, int offset) {
     return offset + 2;
 }
 
+static int registerInstruction(const char* mes, Ram* ram, int offset, bool is_constant) {
+    printf("%s\t%d %d", mes, ram->code[offset + 1], ram->code[offset + 2]);
+    if(is_constant) {
+        printValue(&ram->constants.val[ram->code[offset + 2]], " \"", "\"");
+    }
+    printf("\n");
+    return offset + 3;
+}
+
 static int jumpInstruction(const char* mes, Ram* ram, int offset, bool is_back) {
     uint16_t jump_offset = (ram->code[offset + 2] << 8) + ram->code[offset + 1];
     if(is_back) {
@@ -37,15 +46,53 @@ static int jumpInstruction(const char* mes, Ram* ram, int offset, bool is_back)
     return offset + 3;
 }
 
+static int forInstruction(const char* mes, Ram* ram, int offset, bool is_back) {
+    uint16_t jump_offset = (ram->code[offset + 3] << 8) + ram->code[offset + 2];
+    printf("%s\t%d %d\n", mes, ram->code[offset + 1], is_back ? -(jump_offset - 4) : jump_offset + 4);
+    return offset + 4;
+}
+
+static int inlineInstruction(const char* mes, Ram* ram, int offset) {
+    uint16_t jump_offset = (ram->code[offset + 3] << 8) + ram->code[offset + 2];
+    printf("%s\t%d ", mes, ram->code[offset + 1]);
+    printValue(&ram->constants.val[ram->code[offset + 1]], "\"", "\"");
+    printf(" %d\n", jump_offset + 4);
+    return offset + 4;
+}
+
+// Print where each case body starts, the default one last.
+static int jumpTableInstruction(const char* mes, Ram* ram, int offset) {
+    ObjJumpTable* table = AS_JUMP_TABLE(ram->constants.val[ram->code[offset + 1]]);
+    printf("%s\t%d", mes, ram->code[offset + 1]);
+    for(int i = 0; i < table->target_count; i++) {
+        if(i != table->default_target) printf(" %d", offset + 2 + table->targets[i]);
+    }
+    printf(" default %d\n", offset + 2 + table->targets[table->default_target]);
+    return offset + 2;
+}
+
 static int closureInstruction(const char* mes, Ram* ram, int offset) {
+    static const char* kinds[] = { "upvalue", "local", "copy" };
     int constant_index = ram->code[offset + 1];
-    printf("%s\t%d\n", mes, constant_index);
-    return offset + 2 * (AS_FUNC(ram->constants.val[constant_index])->upvalue_count + 1);
+    int upvalue_count = AS_FUNC(ram->constants.val[constant_index])->upvalue_count;
+    printf("%s\t%d", mes, constant_index);
+    for(int i = 0; i < upvalue_count; i++) {
+        uint8_t kind = ram->code[offset + 2 + 2 * i];
+        printf(" %s %d", kind <= CAPTURE_COPY ? kinds[kind] : "?", ram->code[offset + 3 + 2 * i]);
+    }
+    printf("\n");
+    return offset + 2 * (upvalue_count + 1);
 }
 
 int disassembleInstruction(ObjFunction* func, int offset) {
     printf("\033[1;31m%04d\t\033[0m", offset);
     Ram* ram = &func->ram;
+    int line = getLine(ram, offset);
+    if(offset > 0 && line == getLine(ram, offset - 1)) {
+        printf("   |\t");
+    } else {
+        printf("%4d\t", line);
+    }
     switch(ram->code[offset]) {
         case OP_CONSTANT: {
             return constantInstruction("OP_CONSTANT", ram, offset);
@@ -80,12 +127,78 @@ int disassembleInstruction(ObjFunction* func, int offset) {
         case OP_DIVIDE: {
             return simpleInstruction("OP_DIVIDE", ram, offset);
         }
+        case OP_MODULO: {
+            return simpleInstruction("OP_MODULO", ram, offset);
+        }
+        case OP_BIT_AND: {
+            return simpleInstruction("OP_BIT_AND", ram, offset);
+        }
+        case OP_BIT_OR: {
+            return simpleInstruction("OP_BIT_OR", ram, offset);
+        }
+        case OP_BIT_XOR: {
+            return simpleInstruction("OP_BIT_XOR", ram, offset);
+        }
+        case OP_SHIFT_LEFT: {
+            return simpleInstruction("OP_SHIFT_LEFT", ram, offset);
+        }
+        case OP_SHIFT_RIGHT: {
+            return simpleInstruction("OP_SHIFT_RIGHT", ram, offset);
+        }
+        case OP_BIT_NOT: {
+            return simpleInstruction("OP_BIT_NOT", ram, offset);
+        }
         case OP_GREATER: {
             return simpleInstruction("OP_GREATER", ram, offset);
         }
         case OP_LESS: {
             return simpleInstruction("OP_LESS", ram, offset);
         }
+        case OP_ADD_LL: {
+            return registerInstruction("OP_ADD_LL", ram, offset, false);
+        }
+        case OP_SUBTRACT_LL: {
+            return registerInstruction("OP_SUBTRACT_LL", ram, offset, false);
+        }
+        case OP_MULTIPLY_LL: {
+            return registerInstruction("OP_MULTIPLY_LL", ram, offset, false);
+        }
+        case OP_DIVIDE_LL: {
+            return registerInstruction("OP_DIVIDE_LL", ram, offset, false);
+        }
+        case OP_EQUAL_LL: {
+            return registerInstruction("OP_EQUAL_LL", ram, offset, false);
+        }
+        case OP_GREATER_LL: {
+            return registerInstruction("OP_GREATER_LL", ram, offset, false);
+        }
+        case OP_LESS_LL: {
+            return registerInstruction("OP_LESS_LL", ram, offset, false);
+        }
+        case OP_ADD_LC: {
+            return registerInstruction("OP_ADD_LC", ram, offset, true);
+        }
+        case OP_SUBTRACT_LC: {
+            return registerInstruction("OP_SUBTRACT_LC", ram, offset, true);
+        }
+        case OP_MULTIPLY_LC: {
+            return registerInstruction("OP_MULTIPLY_LC", ram, offset, true);
+        }
+        case OP_DIVIDE_LC: {
+            return registerInstruction("OP_DIVIDE_LC", ram, offset, true);
+        }
+        case OP_EQUAL_LC: {
+            return registerInstruction("OP_EQUAL_LC", ram, offset, true);
+        }
+        case OP_GREATER_LC: {
+            return registerInstruction("OP_GREATER_LC", ram, offset, true);
+        }
+        case OP_LESS_LC: {
+            return registerInstruction("OP_LESS_LC", ram, offset, true);
+        }
+        case OP_STORE_LOCAL: {
+            return variableInstruction("OP_STORE_LOCAL", ram, offset);
+        }
         case OP_PRINT: {
             return simpleInstruction("OP_PRINT", ram, offset);
         }
@@ -113,12 +226,36 @@ int disassembleInstruction(ObjFunction* func, int offset) {
         case OP_JUMP_IF_FALSE: {
             return jumpInstruction("OP_JUMP_IF_FALSE", ram, offset, false);
         }
+        case OP_JUMP_IF_TRUE: {
+            return jumpInstruction("OP_JUMP_IF_TRUE", ram, offset, false);
+        }
         case OP_JUMP: {
             return jumpInstruction("OP_JUMP", ram, offset, false);
         }
         case OP_BACK_JUMP: {
             return jumpInstruction("OP_BACK_JUMP", ram, offset, true);
         }
+        case OP_INLINE_CHECK: {
+            return inlineInstruction("OP_INLINE_CHECK", ram, offset);
+        }
+        case OP_GET_ARG: {
+            return variableInstruction("OP_GET_ARG", ram, offset);
+        }
+        case OP_SET_ARG: {
+            return variableInstruction("OP_SET_ARG", ram, offset);
+        }
+        case OP_INLINE_RETURN: {
+            return simpleInstruction("OP_INLINE_RETURN", ram, offset);
+        }
+        case OP_FOR_PREP: {
+            return forInstruction("OP_FOR_PREP", ram, offset, false);
+        }
+        case OP_FOR_ITER: {
+            return forInstruction("OP_FOR_ITER", ram, offset, true);
+        }
+        case OP_JUMP_TABLE: {
+            return jumpTableInstruction("OP_JUMP_TABLE", ram, offset);
+        }
         case OP_CALL: {
             // return variableInstruction("OP_CALL", ram, offset);
             return variableInstruction("OP_CALL", ram, offset);
@@ -126,6 +263,24 @@ int disassembleInstruction(ObjFunction* func, int offset) {
         case OP_CLOSURE: {
             return closureInstruction("OP_CLOSURE", ram, offset);
         }
+        case OP_LIST: {
+            return variableInstruction("OP_LIST", ram, offset);
+        }
+        case OP_APPEND: {
+            return simpleInstruction("OP_APPEND", ram, offset);
+        }
+        case OP_MAP: {
+            return simpleInstruction("OP_MAP", ram, offset);
+        }
+        case OP_INSERT: {
+            return simpleInstruction("OP_INSERT", ram, offset);
+        }
+        case OP_GET_INDEX: {
+            return simpleInstruction("OP_GET_INDEX", ram, offset);
+        }
+        case OP_SET_INDEX: {
+            return simpleInstruction("OP_SET_INDEX", ram, offset);
+        }
         case OP_POP: {
             return simpleInstruction("OP_POP", ram, offset);
         }
@@ -143,7 +298,7 @@ void disassembleFunction(ObjFunction* function) {
     if(function->type == TYPE_MAIN) {
         printf("********** script **********\n");
     } else {
-        printf("********** %s **********\n", function->func_name->chars);
+        printf("********** %s **********\n", STRING_CHARS(function->func_name));
     }
     for(int i = 0; i < function->ram.count;) {
         i = disassembleInstruction(function, i);
@@ -0,0 +1,703 @@
+// MAP_ANONYMOUS for the code buffers is not in strict C or plain POSIX.
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "mem.h"
+#include "object.h"
+#include "optimize.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+extern VM vm;
+
+#ifdef JIT_SUPPORTED
+
+#include <sys/mman.h>
+
+// A baseline template JIT: every supported opcode is translated to a fixed
+// piece of machine code working on the same VM stack as the interpreter, so
+// the native code can hand control back before any instruction.
+//
+// Registers while native code runs:
+//   rbx   the frame's slots
+//   r12   the stack top
+//   r13   &vm.stack_top, written back when leaving
+// Leaving returns the bytecode ip the interpreter should go on from.
+
+struct JitCode {
+    uint8_t* code;
+    size_t size;
+    uint8_t** entry;    // Native address for each bytecode offset.
+};
+
+typedef uint8_t* (*JitEntry)(Value* slots, Value** stack_top, uint8_t* entry);
+
+// A rel32 operand at 'at' to be pointed at a bytecode offset,
+// or at the exit stub of one if 'to_exit' is set.
+typedef struct {
+    int at;
+    int target;
+    bool to_exit;
+} Fixup;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+} Assembler;
+
+#define VALUE_SIZE ((int)sizeof(Value))
+#define TYPE_AT(index) (-(index) * VALUE_SIZE)              // From r12, index 1 is the top.
+#define PAYLOAD_AT(index) (-(index) * VALUE_SIZE + 8)
+#define SLOT_TYPE(slot) ((slot) * VALUE_SIZE)              // From rbx.
+#define SLOT_PAYLOAD(slot) ((slot) * VALUE_SIZE + 8)
+
+static void emit8(Assembler* as, uint8_t byte) {
+    if(as->count == as->capacity) {
+        as->capacity = GROW_CAPACITY(as->capacity);
+        as->code = GROW_ARRAY(as->code, uint8_t, as->count, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for(int i = 0; i < count; i++) emit8(as, bytes[i]);
+}
+
+static void emit32(Assembler* as, uint32_t val) {
+    for(int i = 0; i < 4; i++) emit8(as, (uint8_t)(val >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t val) {
+    for(int i = 0; i < 8; i++) emit8(as, (uint8_t)(val >> (i * 8)));
+}
+
+#define EMIT(as, ...) \
+    do { \
+        const uint8_t bytes[] = { __VA_ARGS__ }; \
+        emitBytes(as, bytes, sizeof(bytes)); \
+    } while(0)
+
+static void addFixup(Assembler* as, int target, bool to_exit) {
+    if(as->fixup_count == as->fixup_capacity) {
+        as->fixup_capacity = GROW_CAPACITY(as->fixup_capacity);
+        as->fixups = GROW_ARRAY(as->fixups, Fixup, as->fixup_count, as->fixup_capacity);
+    }
+    Fixup* fixup = &as->fixups[as->fixup_count++];
+    fixup->at = as->count;
+    fixup->target = target;
+    fixup->to_exit = to_exit;
+    emit32(as, 0);
+}
+
+// jmp / jcc to the native code of a bytecode offset.
+static void jumpTo(Assembler* as, int target) {
+    emit8(as, 0xe9);
+    addFixup(as, target, false);
+}
+
+static void jccTo(Assembler* as, uint8_t cc, int target) {
+    EMIT(as, 0x0f, cc);
+    addFixup(as, target, false);
+}
+
+// jcc to the stub which leaves native code before the instruction at 'offset'.
+static void jccExit(Assembler* as, uint8_t cc, int offset) {
+    EMIT(as, 0x0f, cc);
+    addFixup(as, offset, true);
+}
+
+#define CC_O    0x80
+#define CC_E    0x84
+#define CC_NE   0x85
+#define CC_BE   0x86
+#define CC_A    0x87
+#define CC_L    0x8c
+#define CC_GE   0x8d
+#define CC_G    0x8f
+
+// A short jcc (0x70 + cc) or jmp (0xeb) inside one template, its rel8 is
+// filled in by 'bindShort' once the label is reached.
+static int shortJump(Assembler* as, uint8_t opcode) {
+    EMIT(as, opcode, 0x00);
+    return as->count - 1;
+}
+
+static void bindShort(Assembler* as, int at) {
+    as->code[at] = (uint8_t)(as->count - (at + 1));
+}
+
+#define SHORT(cc) (uint8_t)((cc) - 0x10)
+#define SHORT_JMP 0xeb
+
+static void movRaxImm(Assembler* as, uint64_t val) {
+    EMIT(as, 0x48, 0xb8);
+    emit64(as, val);
+}
+
+// cmp dword [r12 + disp], type
+static void cmpStackType(Assembler* as, int disp, ValueType type) {
+    EMIT(as, 0x41, 0x83, 0x7c, 0x24, (uint8_t)disp, (uint8_t)type);
+}
+
+// cmp dword [rbx + disp], type
+static void cmpSlotType(Assembler* as, int disp, ValueType type) {
+    EMIT(as, 0x83, 0xbb);
+    emit32(as, disp);
+    emit8(as, (uint8_t)type);
+}
+
+static void guardStackType(Assembler* as, int disp, ValueType type, int offset) {
+    cmpStackType(as, disp, type);
+    jccExit(as, CC_NE, offset);
+}
+
+static void guardSlotType(Assembler* as, int disp, ValueType type, int offset) {
+    cmpSlotType(as, disp, type);
+    jccExit(as, CC_NE, offset);
+}
+
+// Leave native code before an instruction that pushes 'count' values onto
+// a full stack, so the interpreter's 'push' reports the overflow.
+static void guardStackRoom(Assembler* as, int count, int offset) {
+    movRaxImm(as, (uint64_t)(uintptr_t)(vm.stack + STACK_MAX - count));
+    EMIT(as, 0x49, 0x39, 0xc4);                         // cmp r12, rax
+    jccExit(as, CC_A, offset);
+}
+
+// op xmm0, [r12 + disp] with a 'F2 0F op' scalar double instruction.
+static void sdStack(Assembler* as, uint8_t op, int disp) {
+    EMIT(as, 0xf2, 0x41, 0x0f, op, 0x44, 0x24, (uint8_t)disp);
+}
+
+// op xmm<reg>, [rbx + disp]
+static void sdSlot(Assembler* as, uint8_t op, int reg, int disp) {
+    EMIT(as, 0xf2, 0x0f, op, (uint8_t)(0x83 | (reg << 3)));
+    emit32(as, disp);
+}
+
+#define SD_LOAD     0x10
+#define SD_STORE    0x11
+#define SD_ADD      0x58
+#define SD_MUL      0x59
+#define SD_SUB      0x5c
+#define SD_DIV      0x5e
+
+static void pushValue(Assembler* as, Value val) {
+    EMIT(as, 0x41, 0xc7, 0x44, 0x24, 0x00);             // mov dword [r12], type
+    emit32(as, (uint32_t)val.type);
+    uint64_t payload;
+    memcpy(&payload, &val.as, sizeof(payload));
+    movRaxImm(as, payload);
+    EMIT(as, 0x49, 0x89, 0x44, 0x24, 0x08);             // mov [r12 + 8], rax
+    EMIT(as, 0x49, 0x83, 0xc4, (uint8_t)VALUE_SIZE);    // add r12, 16
+}
+
+static void popValue(Assembler* as) {
+    EMIT(as, 0x49, 0x83, 0xec, (uint8_t)VALUE_SIZE);    // sub r12, 16
+}
+
+static void pushLocal(Assembler* as, int slot) {
+    EMIT(as, 0xf3, 0x0f, 0x6f, 0x83);                   // movdqu xmm0, [rbx + slot]
+    emit32(as, SLOT_TYPE(slot));
+    EMIT(as, 0xf3, 0x41, 0x0f, 0x7f, 0x44, 0x24, 0x00); // movdqu [r12], xmm0
+    EMIT(as, 0x49, 0x83, 0xc4, (uint8_t)VALUE_SIZE);
+}
+
+// Copy the top into a local, leaving it on the stack.
+static void storeLocal(Assembler* as, int slot) {
+    EMIT(as, 0xf3, 0x41, 0x0f, 0x6f, 0x44, 0x24, (uint8_t)TYPE_AT(1));  // movdqu xmm0, [r12 - 16]
+    EMIT(as, 0xf3, 0x0f, 0x7f, 0x83);                   // movdqu [rbx + slot], xmm0
+    emit32(as, SLOT_TYPE(slot));
+}
+
+// Both operands must be doubles, otherwise the interpreter takes over,
+// e.g. to concatenate strings or report the error.
+static void guardTwoNumbers(Assembler* as, int offset) {
+    guardStackType(as, TYPE_AT(2), NUMBER, offset);
+    guardStackType(as, TYPE_AT(1), NUMBER, offset);
+}
+
+// call a C helper, the stack is 16-byte aligned after the prologue.
+static void callHelper(Assembler* as, void* helper) {
+    movRaxImm(as, (uint64_t)(uintptr_t)helper);
+    EMIT(as, 0xff, 0xd0);                               // call rax
+}
+
+// What the templates leave to C: an integer overflow, mixed operands and
+// integer division, with the same rules as 'NUMBER_OP' in the interpreter.
+static bool jitArithmetic(Value* operands, int op) {
+    Value a = operands[0];
+    Value b = operands[1];
+    switch(op) {
+        case OP_ADD:        return NUMBER_OP(a, b, __builtin_add_overflow, +, operands[0]);
+        case OP_SUBTRACT:   return NUMBER_OP(a, b, __builtin_sub_overflow, -, operands[0]);
+        case OP_MULTIPLY:   return NUMBER_OP(a, b, __builtin_mul_overflow, *, operands[0]);
+        case OP_DIVIDE:     return NUMBER_OP(a, b, divideOverflow, /, operands[0]);
+        default:            return false;
+    }
+}
+
+// Two integers and two doubles are done inline, anything else calls
+// 'jitArithmetic', which leaves native code for non-numbers.
+static void arithmetic(Assembler* as, uint8_t op, int offset) {
+    static const uint8_t sd_op[] = { SD_ADD, SD_SUB, SD_MUL, SD_DIV };
+    cmpStackType(as, TYPE_AT(2), INT);
+    int not_int = shortJump(as, SHORT(CC_NE));
+    cmpStackType(as, TYPE_AT(1), INT);
+    int int_slow = shortJump(as, SHORT(CC_NE));
+    int int_overflow = -1;
+    if(op != OP_DIVIDE) {
+        EMIT(as, 0x49, 0x8b, 0x44, 0x24, (uint8_t)PAYLOAD_AT(2));          // mov rax, [r12 + a]
+        switch(op) {
+            case OP_ADD:        EMIT(as, 0x49, 0x03, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1)); break;
+            case OP_SUBTRACT:   EMIT(as, 0x49, 0x2b, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1)); break;
+            case OP_MULTIPLY:   EMIT(as, 0x49, 0x0f, 0xaf, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1)); break;
+        }
+        int_overflow = shortJump(as, SHORT(CC_O));
+        EMIT(as, 0x49, 0x89, 0x44, 0x24, (uint8_t)PAYLOAD_AT(2));          // mov [r12 + a], rax
+    }
+    int int_done = op != OP_DIVIDE ? shortJump(as, SHORT_JMP) : -1;
+
+    bindShort(as, not_int);
+    cmpStackType(as, TYPE_AT(2), NUMBER);
+    int double_slow = shortJump(as, SHORT(CC_NE));
+    cmpStackType(as, TYPE_AT(1), NUMBER);
+    int double_slow2 = shortJump(as, SHORT(CC_NE));
+    sdStack(as, SD_LOAD, PAYLOAD_AT(2));
+    sdStack(as, sd_op[op - OP_ADD], PAYLOAD_AT(1));
+    sdStack(as, SD_STORE, PAYLOAD_AT(2));
+    int double_done = shortJump(as, SHORT_JMP);
+
+    bindShort(as, int_slow);
+    if(int_overflow >= 0) bindShort(as, int_overflow);
+    bindShort(as, double_slow);
+    bindShort(as, double_slow2);
+    EMIT(as, 0x49, 0x8d, 0x7c, 0x24, (uint8_t)TYPE_AT(2));    // lea rdi, [r12 - 32]
+    EMIT(as, 0xbe);                                         // mov esi, op
+    emit32(as, op);
+    callHelper(as, (void*)jitArithmetic);
+    EMIT(as, 0x84, 0xc0);                                   // test al, al
+    jccExit(as, CC_E, offset);
+
+    if(int_done >= 0) bindShort(as, int_done);
+    bindShort(as, double_done);
+    popValue(as);
+}
+
+// Replace the two operands with the boolean in al.
+static void storeBoolean(Assembler* as) {
+    EMIT(as, 0x0f, 0xb6, 0xc0);                         // movzx eax, al
+    EMIT(as, 0x41, 0xc7, 0x44, 0x24, (uint8_t)TYPE_AT(2));
+    emit32(as, BOOLEAN);
+    EMIT(as, 0x49, 0x89, 0x44, 0x24, (uint8_t)PAYLOAD_AT(2));
+    popValue(as);
+}
+
+// Two integers are compared inline and set al with 'setcc', then the code
+// goes on at the returned short jump. Anything but two doubles leaves
+// native code at the returned 'not_int' label.
+static int compareInts(Assembler* as, uint8_t setcc, int offset, int* not_int) {
+    cmpStackType(as, TYPE_AT(2), INT);
+    *not_int = shortJump(as, SHORT(CC_NE));
+    guardStackType(as, TYPE_AT(1), INT, offset);
+    EMIT(as, 0x49, 0x8b, 0x44, 0x24, (uint8_t)PAYLOAD_AT(2));  // mov rax, [r12 + a]
+    EMIT(as, 0x49, 0x3b, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1));  // cmp rax, [r12 + b]
+    EMIT(as, 0x0f, setcc, 0xc0);                                // setcc al
+    return shortJump(as, SHORT_JMP);
+}
+
+// 'a > b' is computed as 'a > b' and 'a < b' as 'b > a', so NaN gives false.
+static void compare(Assembler* as, bool is_less, int offset) {
+    int not_int;
+    int done = compareInts(as, is_less ? 0x9c : 0x9f, offset, &not_int);  // setl / setg
+    bindShort(as, not_int);
+    guardTwoNumbers(as, offset);
+    sdStack(as, SD_LOAD, is_less ? PAYLOAD_AT(1) : PAYLOAD_AT(2));
+    EMIT(as, 0x66, 0x41, 0x0f, 0x2f, 0x44, 0x24,
+         (uint8_t)(is_less ? PAYLOAD_AT(2) : PAYLOAD_AT(1)));   // comisd xmm0, [r12 + disp]
+    EMIT(as, 0x0f, 0x97, 0xc0);                                 // seta al
+    bindShort(as, done);
+    storeBoolean(as);
+}
+
+static void equal(Assembler* as, int offset) {
+    int not_int;
+    int done = compareInts(as, 0x94, offset, &not_int);          // sete
+    bindShort(as, not_int);
+    guardTwoNumbers(as, offset);
+    sdStack(as, SD_LOAD, PAYLOAD_AT(2));
+    EMIT(as, 0x66, 0x41, 0x0f, 0x2e, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1));  // ucomisd xmm0, [r12 + disp]
+    EMIT(as, 0x0f, 0x94, 0xc0);                         // sete al
+    EMIT(as, 0x0f, 0x9b, 0xc1);                         // setnp cl
+    EMIT(as, 0x20, 0xc8);                               // and al, cl
+    bindShort(as, done);
+    storeBoolean(as);
+}
+
+// The same truth rule as 'handleCondition' in vm.c.
+static int jitIsTruthy(Value* val) {
+    Value cond = *val;
+    if(IS_NUMBER(cond)) return AS_NUMBER(cond) != 0;
+    if(IS_INT(cond)) return AS_INT(cond) != 0;
+    if(IS_NIL(cond)) return 0;
+    return AS_BOOLEAN(cond);
+}
+
+// Globals go through the same inline caches as in the interpreter,
+// which reports a missing one.
+static bool jitGetGlobal(Value* top, ObjString* key, EntryCache* cache) {
+    Entry* entry = tableGetCached(&vm.globals, key, cache);
+    if(entry == NULL) return false;
+    *top = entry->val;
+    return true;
+}
+
+static bool jitSetGlobal(Value* val, ObjString* key, EntryCache* cache) {
+    Entry* entry = tableGetCached(&vm.globals, key, cache);
+    if(entry == NULL) return false;
+    entry->val = *val;
+    return true;
+}
+
+static void globalAccess(Assembler* as, void* helper, int disp, Ram* ram, int offset) {
+    ObjString* key = AS_STRING(ram->constants.val[ram->code[offset + 1]]);
+    EMIT(as, 0x49, 0x8d, 0x7c, 0x24, (uint8_t)disp);    // lea rdi, [r12 + disp]
+    EMIT(as, 0x48, 0xbe);                               // mov rsi, key
+    emit64(as, (uint64_t)(uintptr_t)key);
+    EMIT(as, 0x48, 0xba);                               // mov rdx, cache
+    emit64(as, (uint64_t)(uintptr_t)&ram->global_cache[offset]);
+    callHelper(as, helper);
+    EMIT(as, 0x84, 0xc0);                               // test al, al
+    jccExit(as, CC_E, offset);
+}
+
+// Guard that the operands are both integers or both doubles where they
+// live, then run the stack template on copies of them, which can no
+// longer leave native code with the copies pushed.
+static void registerForm(Assembler* as, Ram* ram, int offset) {
+    uint8_t* code = ram->code;
+    bool is_constant = code[offset] >= OP_ADD_LC;
+    uint8_t op = OP_ADD + code[offset] - (is_constant ? OP_ADD_LC : OP_ADD_LL);
+    Value constant = is_constant ? ram->constants.val[code[offset + 2]] : VALUE_NIL;
+    if(is_constant && !IS_NUMERIC(constant)) {
+        EMIT(as, 0xe9);
+        addFixup(as, offset, true);
+        return;
+    }
+    if(is_constant) {
+        guardSlotType(as, SLOT_TYPE(code[offset + 1]), constant.type, offset);
+    } else {
+        EMIT(as, 0x8b, 0x83);                           // mov eax, [rbx + a]
+        emit32(as, SLOT_TYPE(code[offset + 1]));
+        EMIT(as, 0x3b, 0x83);                           // cmp eax, [rbx + b]
+        emit32(as, SLOT_TYPE(code[offset + 2]));
+        jccExit(as, CC_NE, offset);
+        EMIT(as, 0x83, 0xf8, (uint8_t)INT);             // cmp eax, INT
+        int is_int = shortJump(as, SHORT(CC_E));
+        EMIT(as, 0x83, 0xf8, (uint8_t)NUMBER);          // cmp eax, NUMBER
+        jccExit(as, CC_NE, offset);
+        bindShort(as, is_int);
+    }
+
+    guardStackRoom(as, 2, offset);
+    pushLocal(as, code[offset + 1]);
+    if(is_constant) {
+        pushValue(as, constant);
+    } else {
+        pushLocal(as, code[offset + 2]);
+    }
+    switch(op) {
+        case OP_ADD:        arithmetic(as, OP_ADD, offset); break;
+        case OP_SUBTRACT:   arithmetic(as, OP_SUBTRACT, offset); break;
+        case OP_MULTIPLY:   arithmetic(as, OP_MULTIPLY, offset); break;
+        case OP_DIVIDE:     arithmetic(as, OP_DIVIDE, offset); break;
+        case OP_EQUAL:      equal(as, offset); break;
+        case OP_GREATER:    compare(as, false, offset); break;
+        case OP_LESS:       compare(as, true, offset); break;
+    }
+}
+
+// An integer counter needs an integer limit, a double one the double
+// code after the returned short jump. Leaves the counter in rax.
+static int intRange(Assembler* as, int slot, int offset) {
+    cmpSlotType(as, SLOT_TYPE(slot), INT);
+    int not_int = shortJump(as, SHORT(CC_NE));
+    guardSlotType(as, SLOT_TYPE(slot + 1), INT, offset);
+    EMIT(as, 0x48, 0x8b, 0x83);                         // mov rax, [rbx + counter]
+    emit32(as, SLOT_PAYLOAD(slot));
+    return not_int;
+}
+
+static uint16_t jumpOperand(Ram* ram, int offset) {
+    return (uint16_t)((ram->code[offset + 2] << 8) + ram->code[offset + 1]);
+}
+
+static uint16_t forOperand(Ram* ram, int offset) {
+    return (uint16_t)((ram->code[offset + 3] << 8) + ram->code[offset + 2]);
+}
+
+// Translate one instruction, or leave native code before an unsupported one.
+static void translate(Assembler* as, Ram* ram, int offset) {
+    uint8_t* code = ram->code;
+    // Instructions that push check for room first.
+    switch(code[offset]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL: guardStackRoom(as, 1, offset); break;
+        default:            break;
+    }
+    switch(code[offset]) {
+        case OP_CONSTANT:   pushValue(as, ram->constants.val[code[offset + 1]]); break;
+        case OP_NIL:        pushValue(as, VALUE_NIL); break;
+        case OP_TRUE:       pushValue(as, VALUE_BOOLEAN(true)); break;
+        case OP_FALSE:      pushValue(as, VALUE_BOOLEAN(false)); break;
+        case OP_POP:        popValue(as); break;
+        case OP_ADD:        arithmetic(as, OP_ADD, offset); break;
+        case OP_SUBTRACT:   arithmetic(as, OP_SUBTRACT, offset); break;
+        case OP_MULTIPLY:   arithmetic(as, OP_MULTIPLY, offset); break;
+        case OP_DIVIDE:     arithmetic(as, OP_DIVIDE, offset); break;
+        case OP_LESS:       compare(as, true, offset); break;
+        case OP_GREATER:    compare(as, false, offset); break;
+        case OP_EQUAL:      equal(as, offset); break;
+        case OP_NEGATE: {
+            cmpStackType(as, TYPE_AT(1), INT);
+            int not_int = shortJump(as, SHORT(CC_NE));
+            // Negating INT64_MIN overflows and leaves it unchanged.
+            EMIT(as, 0x49, 0xf7, 0x5c, 0x24, (uint8_t)PAYLOAD_AT(1));  // neg qword [r12 + disp]
+            jccExit(as, CC_O, offset);
+            int done = shortJump(as, SHORT_JMP);
+            bindShort(as, not_int);
+            guardStackType(as, TYPE_AT(1), NUMBER, offset);
+            movRaxImm(as, 0x8000000000000000ull);
+            EMIT(as, 0x49, 0x31, 0x44, 0x24, (uint8_t)PAYLOAD_AT(1));  // xor [r12 + disp], rax
+            bindShort(as, done);
+            break;
+        }
+        case OP_NOT: {
+            guardStackType(as, TYPE_AT(1), BOOLEAN, offset);
+            EMIT(as, 0x41, 0x80, 0x74, 0x24, (uint8_t)PAYLOAD_AT(1), 0x01);  // xor byte [r12 + disp], 1
+            break;
+        }
+        case OP_GET_LOCAL:  pushLocal(as, code[offset + 1]); break;
+        case OP_SET_LOCAL:  storeLocal(as, code[offset + 1]); break;
+        case OP_STORE_LOCAL: {
+            storeLocal(as, code[offset + 1]);
+            popValue(as);
+            break;
+        }
+        case OP_ADD_LL:
+        case OP_SUBTRACT_LL:
+        case OP_MULTIPLY_LL:
+        case OP_DIVIDE_LL:
+        case OP_EQUAL_LL:
+        case OP_GREATER_LL:
+        case OP_LESS_LL:
+        case OP_ADD_LC:
+        case OP_SUBTRACT_LC:
+        case OP_MULTIPLY_LC:
+        case OP_DIVIDE_LC:
+        case OP_EQUAL_LC:
+        case OP_GREATER_LC:
+        case OP_LESS_LC:
+            registerForm(as, ram, offset);
+            break;
+        case OP_GET_GLOBAL: {
+            globalAccess(as, (void*)jitGetGlobal, 0, ram, offset);
+            EMIT(as, 0x49, 0x83, 0xc4, (uint8_t)VALUE_SIZE);
+            break;
+        }
+        case OP_SET_GLOBAL: {
+            globalAccess(as, (void*)jitSetGlobal, TYPE_AT(1), ram, offset);
+            break;
+        }
+        case OP_JUMP: {
+            jumpTo(as, offset + 3 + jumpOperand(ram, offset));
+            break;
+        }
+        case OP_BACK_JUMP: {
+            jumpTo(as, offset + 3 - jumpOperand(ram, offset));
+            break;
+        }
+        case OP_JUMP_IF_FALSE: {
+            EMIT(as, 0x49, 0x8d, 0x7c, 0x24, (uint8_t)TYPE_AT(1));    // lea rdi, [r12 - 16]
+            callHelper(as, (void*)jitIsTruthy);
+            EMIT(as, 0x85, 0xc0);                       // test eax, eax
+            jccTo(as, CC_E, offset + 3 + jumpOperand(ram, offset));
+            break;
+        }
+        case OP_JUMP_IF_TRUE: {
+            EMIT(as, 0x49, 0x8d, 0x7c, 0x24, (uint8_t)TYPE_AT(1));    // lea rdi, [r12 - 16]
+            callHelper(as, (void*)jitIsTruthy);
+            EMIT(as, 0x85, 0xc0);                       // test eax, eax
+            jccTo(as, CC_NE, offset + 3 + jumpOperand(ram, offset));
+            break;
+        }
+        case OP_FOR_PREP: {
+            int slot = code[offset + 1];
+            int not_int = intRange(as, slot, offset);
+            EMIT(as, 0x48, 0x3b, 0x83);                 // cmp rax, [rbx + limit]
+            emit32(as, SLOT_PAYLOAD(slot + 1));
+            jccTo(as, CC_GE, offset + 4 + forOperand(ram, offset));
+            int done = shortJump(as, SHORT_JMP);
+            bindShort(as, not_int);
+            guardSlotType(as, SLOT_TYPE(slot), NUMBER, offset);
+            guardSlotType(as, SLOT_TYPE(slot + 1), NUMBER, offset);
+            sdSlot(as, SD_LOAD, 0, SLOT_PAYLOAD(slot + 1));
+            EMIT(as, 0x66, 0x0f, 0x2f, 0x83);           // comisd xmm0, [rbx + counter]
+            emit32(as, SLOT_PAYLOAD(slot));
+            jccTo(as, CC_BE, offset + 4 + forOperand(ram, offset));
+            bindShort(as, done);
+            break;
+        }
+        case OP_FOR_ITER: {
+            int slot = code[offset + 1];
+            int not_int = intRange(as, slot, offset);
+            EMIT(as, 0x48, 0x83, 0xc0, 0x01);           // add rax, 1
+            jccExit(as, CC_O, offset);
+            EMIT(as, 0x48, 0x89, 0x83);                 // mov [rbx + counter], rax
+            emit32(as, SLOT_PAYLOAD(slot));
+            EMIT(as, 0x48, 0x3b, 0x83);                 // cmp rax, [rbx + limit]
+            emit32(as, SLOT_PAYLOAD(slot + 1));
+            jccTo(as, CC_L, offset + 4 - forOperand(ram, offset));
+            int done = shortJump(as, SHORT_JMP);
+            bindShort(as, not_int);
+            guardSlotType(as, SLOT_TYPE(slot), NUMBER, offset);
+            sdSlot(as, SD_LOAD, 0, SLOT_PAYLOAD(slot));
+            movRaxImm(as, 0x3ff0000000000000ull);       // 1.0
+            EMIT(as, 0x66, 0x48, 0x0f, 0x6e, 0xc8);     // movq xmm1, rax
+            EMIT(as, 0xf2, 0x0f, 0x58, 0xc1);           // addsd xmm0, xmm1
+            sdSlot(as, SD_STORE, 0, SLOT_PAYLOAD(slot));
+            sdSlot(as, SD_LOAD, 1, SLOT_PAYLOAD(slot + 1));
+            EMIT(as, 0x66, 0x0f, 0x2f, 0xc8);           // comisd xmm1, xmm0
+            jccTo(as, CC_A, offset + 4 - forOperand(ram, offset));
+            bindShort(as, done);
+            break;
+        }
+        default: {
+            // Not supported, the interpreter runs it.
+            EMIT(as, 0xe9);
+            addFixup(as, offset, true);
+            break;
+        }
+    }
+}
+
+// mov rax, ip ; jmp epilogue
+static void emitExit(Assembler* as, uint8_t* ip, int epilogue) {
+    movRaxImm(as, (uint64_t)(uintptr_t)ip);
+    emit8(as, 0xe9);
+    emit32(as, (uint32_t)(epilogue - (as->count + 4)));
+}
+
+static void patch32(Assembler* as, int at, int target) {
+    uint32_t rel = (uint32_t)(target - (at + 4));
+    memcpy(as->code + at, &rel, sizeof(rel));
+}
+
+bool jitCompile(ObjFunction* function) {
+    Ram* ram = &function->ram;
+    if(ram->count == 0) return false;
+
+    Assembler as = { NULL, 0, 0, NULL, 0, 0 };
+    int* label = (int*)malloc(sizeof(int) * ram->count);
+    int* exit_label = (int*)malloc(sizeof(int) * ram->count);
+    for(int i = 0; i < ram->count; i++) {
+        label[i] = -1;
+        exit_label[i] = -1;
+    }
+
+    // Prologue: push rbx, r12, r13 ; mov rbx, rdi ; mov r13, rsi ; mov r12, [rsi] ; jmp rdx
+    EMIT(&as, 0x53, 0x41, 0x54, 0x41, 0x55);
+    EMIT(&as, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf5, 0x4c, 0x8b, 0x26, 0xff, 0xe2);
+
+    // Epilogue: mov [r13], r12 ; pop r13 ; pop r12 ; pop rbx ; ret
+    int epilogue = as.count;
+    EMIT(&as, 0x4d, 0x89, 0x65, 0x00, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+    for(int offset = 0; offset < ram->count; offset += instructionLength(ram, offset)) {
+        label[offset] = as.count;
+        translate(&as, ram, offset);
+    }
+
+    for(int i = 0; i < as.fixup_count; i++) {
+        Fixup* fixup = &as.fixups[i];
+        if(!fixup->to_exit) continue;
+        if(exit_label[fixup->target] == -1) {
+            exit_label[fixup->target] = as.count;
+            emitExit(&as, ram->code + fixup->target, epilogue);
+        }
+    }
+    for(int i = 0; i < as.fixup_count; i++) {
+        Fixup* fixup = &as.fixups[i];
+        int target = fixup->to_exit ? exit_label[fixup->target] : label[fixup->target];
+        patch32(&as, fixup->at, target);
+    }
+
+    void* code = mmap(NULL, as.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool is_ok = code != MAP_FAILED;
+    if(is_ok) {
+        memcpy(code, as.code, as.count);
+        is_ok = mprotect(code, as.count, PROT_READ | PROT_EXEC) == 0;
+    }
+    if(is_ok) {
+        JitCode* jit = (JitCode*)malloc(sizeof(JitCode));
+        jit->code = (uint8_t*)code;
+        jit->size = as.count;
+        jit->entry = (uint8_t**)malloc(sizeof(uint8_t*) * ram->count);
+        for(int i = 0; i < ram->count; i++) {
+            jit->entry[i] = label[i] == -1 ? NULL : jit->code + label[i];
+        }
+        function->jit = jit;
+    } else if(code != MAP_FAILED) {
+        munmap(code, as.count);
+    }
+
+    free(label);
+    free(exit_label);
+    if(as.code) FREE(as.code, "free jit buffer\n");
+    if(as.fixups) FREE(as.fixups, "free jit fixups\n");
+    return is_ok;
+}
+
+// Run native code from 'ip' until it leaves, and return where the
+// interpreter should go on.
+uint8_t* jitRun(ObjFunction* function, Value* slots, uint8_t* ip) {
+    JitCode* jit = function->jit;
+    uint8_t* entry = jit->entry[ip - function->ram.code];
+    return ((JitEntry)(void*)jit->code)(slots, &vm.stack_top, entry);
+}
+
+void jitFree(JitCode* jit) {
+    if(jit == NULL) return;
+    munmap(jit->code, jit->size);
+    FREE(jit->entry, "free jit->entry\n");
+    FREE(jit, "free JitCode\n");
+}
+
+#else
+
+bool jitCompile(ObjFunction* function) {
+    return false;
+}
+
+uint8_t* jitRun(ObjFunction* function, Value* slots, uint8_t* ip) {
+    return ip;
+}
+
+void jitFree(JitCode* jit) {
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "value.h"
+
+// Only x86-64 Linux gets native code, elsewhere 'jitCompile' always fails.
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+// Calls plus loop back-edges before a function is compiled.
+#define JIT_HOT_THRESHOLD 1000
+
+typedef struct JitCode JitCode;
+
+bool jitCompile(ObjFunction* function);
+uint8_t* jitRun(ObjFunction* function, Value* slots, uint8_t* ip);
+void jitFree(JitCode* jit);
+
+#endif // !__JIT_H__
@@ -1,39 +1,97 @@
+// madvise() needs the BSD names, fdopen() POSIX, getline() POSIX.1-2008.
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "compiler.h"
 #include "vm.h"
 #include "hint.h"
 
-// Wiriten by Roberts in clox.
-static char* readFile(const char* path) {
-	FILE* file = fopen(path, "rb");
-	if(file == NULL) {
-		fprintf(stderr, "Could not open file \"%s\".\n", path);
-		exit(74);
-	}
+extern VM vm;
 
-	fseek(file, 0L, SEEK_END);
-	size_t fileSize = ftell(file);
-	rewind(file);
+// 'chars' has no trailing '\0', the scanner stops at 'length'.
+typedef struct {
+    char* chars;
+    size_t length;
+    bool is_mapped;
+} Source;
 
-	char* buffer = (char*)malloc(fileSize + 1);
+// Pipes and stdin can't be mapped, so read them chunk by chunk.
+static void readStream(FILE* file, const char* path, Source* source) {
+    size_t capacity = 4096;
+    source->chars = (char*)malloc(capacity);
+    source->length = 0;
+    source->is_mapped = false;
+    for(;;) {
+        if(source->chars == NULL) {
+            fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+            exit(74);
+        }
+        size_t bytes_read = fread(source->chars + source->length, sizeof(char), capacity - source->length, file);
+        source->length += bytes_read;
+        if(source->length < capacity) {
+            break;
+        }
+        capacity *= 2;
+        source->chars = (char*)realloc(source->chars, capacity);
+    }
+    if(ferror(file)) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+}
 
-	if(buffer == NULL) {
-		fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-		exit(74);
-	}
+// Map a regular file straight into memory, so there is no copy and
+// concurrent runs share the page cache. "-" reads stdin.
+static Source loadSource(const char* path) {
+    Source source;
+    if(strcmp(path, "-") == 0) {
+        readStream(stdin, "stdin", &source);
+        return source;
+    }
 
-	size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-	if(bytesRead < fileSize) {
-		fprintf(stderr, "Could not read file \"%s\".\n", path);
-		exit(74);
-	}
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped != MAP_FAILED) {
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            source.chars = (char*)mapped;
+            source.length = st.st_size;
+            source.is_mapped = true;
+            return source;
+        }
+    }
 
-    // If read '\0', which means reaching the end of buffer.
-	buffer[bytesRead] = '\0';
+    FILE* file = fdopen(fd, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    readStream(file, path, &source);
+    fclose(file);
+    return source;
+}
 
-	fclose(file);
-	return buffer;
+static void freeSource(Source* source) {
+    if(source->is_mapped) {
+        munmap(source->chars, source->length);
+    } else {
+        free(source->chars);
+    }
 }
 
 static void errorHint(PROCESS_RESULT res) {
@@ -44,15 +102,108 @@ static void errorHint(PROCESS_RESULT res) {
     }
 }
 
+// How many '{' are still open, so a definition can span several lines.
+static int openBraces(const char* chars, size_t length) {
+    int depth = 0;
+    bool in_string = false;
+    for(size_t i = 0; i < length; i++) {
+        if(chars[i] == '\"') {
+            in_string = !in_string;
+        } else if(!in_string && chars[i] == '{') {
+            depth++;
+        } else if(!in_string && chars[i] == '}') {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+// Keep one VM for the whole session, each input is compiled as a new
+// top-level chunk against the same globals and interned strings.
+static void repl() {
+    vm.print_code = false;
+    char* input = NULL;
+    size_t input_length = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    for(;;) {
+        printf(input_length == 0 ? "> " : "... ");
+        fflush(stdout);
+        ssize_t line_length = getline(&line, &line_capacity, stdin);
+        if(line_length == -1) {
+            printf("\n");
+            break;
+        }
+        input = (char*)realloc(input, input_length + line_length);
+        memcpy(input + input_length, line, line_length);
+        input_length += line_length;
+        if(openBraces(input, input_length) > 0) {
+            continue;
+        }
+        errorHint(interpret(input, input_length));
+        input_length = 0;
+    }
+    free(line);
+    free(input);
+}
+
 int main(int argc, char* argv[]) {
-    if(argc == 1 || argc > 2) {
+    // clox --bench-scan <file>: measure the scanner alone.
+    if(argc == 3 && strcmp(argv[1], "--bench-scan") == 0) {
+        Source source = loadSource(argv[2]);
+        benchScan(source.chars, source.length);
+        freeSource(&source);
+        return 0;
+    }
+    if(argc == 1) {
+        initVM();
+        repl();
+        freeVM();
+        return 0;
+    }
+    // clox [--lazy] [--jit] [--jit-stats] [--reg] [--inline] <file>: compile
+    // function bodies on their first call, compile hot functions to native
+    // code (and report how often it ran), use register forms, splice small
+    // leaf functions into their callers.
+    bool lazy_compile = false;
+    bool jit_enabled = false;
+    bool jit_stats = false;
+    bool register_ops = false;
+    bool inline_calls = false;
+    while(argc > 2) {
+        if(strcmp(argv[1], "--lazy") == 0) {
+            lazy_compile = true;
+        } else if(strcmp(argv[1], "--jit") == 0) {
+            jit_enabled = true;
+        } else if(strcmp(argv[1], "--jit-stats") == 0) {
+            jit_enabled = true;
+            jit_stats = true;
+        } else if(strcmp(argv[1], "--reg") == 0) {
+            register_ops = true;
+        } else if(strcmp(argv[1], "--inline") == 0) {
+            inline_calls = true;
+        } else {
+            break;
+        }
+        argv++;
+        argc--;
+    }
+    if(argc > 2) {
         return 1;
     }
-    char* source = readFile(argv[1]);
-    // char* source = NULL;
+    Source source = loadSource(argv[1]);
     initVM();
-    PROCESS_RESULT res = interpret(source);
+    vm.lazy_compile = lazy_compile;
+    vm.jit_enabled = jit_enabled;
+    vm.register_ops = register_ops;
+    vm.inline_calls = inline_calls;
+    // Tokens point into the source, so keep it until the run is over.
+    PROCESS_RESULT res = interpret(source.chars, source.length);
+    if(jit_stats) {
+        fprintf(stderr, "jit_runs=%ld\n", vm.jit_runs);
+    }
     freeVM();
+    freeSource(&source);
     errorHint(res);
     return 0;
 }
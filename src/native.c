@@ -0,0 +1,135 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "native.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+extern VM vm;
+
+static bool lenNative(Value* args, Value* result) {
+    if(IS_STRING(args[0])) {
+        *result = VALUE_INT(AS_STRING(args[0])->length);
+        return true;
+    }
+    if(IS_LIST(args[0])) {
+        *result = VALUE_INT(AS_LIST(args[0])->items.count);
+        return true;
+    }
+    if(IS_MAP(args[0])) {
+        // 'count' includes tombstones, so count the live entries.
+        Table* table = &AS_MAP(args[0])->table;
+        int count = 0;
+        for(int i = tableNext(table, -1); i != -1; i = tableNext(table, i)) {
+            count++;
+        }
+        *result = VALUE_INT(count);
+        return true;
+    }
+    return false;
+}
+
+static bool capNative(Value* args, Value* result) {
+    if(!IS_LIST(args[0])) return false;
+    *result = VALUE_INT(AS_LIST(args[0])->items.capacity);
+    return true;
+}
+
+static bool appendNative(Value* args, Value* result) {
+    if(!IS_LIST(args[0])) return false;
+    addOne(&AS_LIST(args[0])->items, args[1]);
+    *result = args[0];
+    return true;
+}
+
+static bool keysNative(Value* args, Value* result) {
+    if(!IS_MAP(args[0])) return false;
+    Table* table = &AS_MAP(args[0])->table;
+    ObjList* list = allocateObjList(0);
+    for(int i = tableNext(table, -1); i != -1; i = tableNext(table, i)) {
+        addOne(&list->items, table->entry[i].key);
+    }
+    *result = VALUE_OBJ(list);
+    return true;
+}
+
+static bool hasNative(Value* args, Value* result) {
+    if(!IS_MAP(args[0])) return false;
+    Value val;
+    *result = VALUE_BOOLEAN(tableGetValue(&AS_MAP(args[0])->table, args[1], &val));
+    return true;
+}
+
+static bool removeNative(Value* args, Value* result) {
+    if(!IS_MAP(args[0])) return false;
+    *result = VALUE_BOOLEAN(tableDeleteValue(&AS_MAP(args[0])->table, args[1]));
+    return true;
+}
+
+// An integral number in [0, max].
+static bool toBound(Value val, int max, int* res) {
+    if(!IS_NUMERIC(val)) return false;
+    double bound = TO_DOUBLE(val);
+    if(!(bound >= 0 && bound <= max) || bound != (int)bound) return false;
+    *res = (int)bound;
+    return true;
+}
+
+// 'substr(s, start, length)', a view into 's' unless it is short.
+static bool substrNative(Value* args, Value* result) {
+    if(!IS_STRING(args[0])) return false;
+    ObjString* str = AS_STRING(args[0]);
+    int start, length;
+    if(!toBound(args[1], str->length, &start) || !toBound(args[2], str->length - start, &length)) {
+        return false;
+    }
+    *result = VALUE_OBJ(sliceObjString(str, start, length));
+    return true;
+}
+
+// 'split(s, separator)', a list of the slices of 's' between separators.
+static bool splitNative(Value* args, Value* result) {
+    if(!IS_STRING(args[0]) || !IS_STRING(args[1])) return false;
+    ObjString* str = AS_STRING(args[0]);
+    ObjString* separator = AS_STRING(args[1]);
+    if(separator->length == 0) return false;
+    const char* chars = STRING_CHARS(str);
+    const char* sep = STRING_CHARS(separator);
+    ObjList* list = allocateObjList(0);
+    int start = 0;
+    int last = str->length - separator->length;
+    for(int i = 0; i <= last; ) {
+        const char* found = memchr(chars + i, sep[0], last - i + 1);
+        if(found == NULL) break;
+        i = (int)(found - chars);
+        if(memcmp(found, sep, separator->length) == 0) {
+            addOne(&list->items, VALUE_OBJ(sliceObjString(str, start, i - start)));
+            i += separator->length;
+            start = i;
+        } else {
+            i++;
+        }
+    }
+    addOne(&list->items, VALUE_OBJ(sliceObjString(str, start, str->length - start)));
+    *result = VALUE_OBJ(list);
+    return true;
+}
+
+static void defineNative(const char* name, NativeFn function, int arity) {
+    // Global keys are compared by pointer, so the name must be interned.
+    ObjString* native_name = AS_STRING(allocateString(name, strlen(name)));
+    tableSet(&vm.globals, native_name, VALUE_OBJ(allocateObjNative(function, native_name, arity)));
+}
+
+void defineNatives() {
+    defineNative("len", lenNative, 1);
+    defineNative("cap", capNative, 1);
+    defineNative("append", appendNative, 2);
+    defineNative("keys", keysNative, 1);
+    defineNative("has", hasNative, 2);
+    defineNative("remove", removeNative, 2);
+    defineNative("substr", substrNative, 3);
+    defineNative("split", splitNative, 2);
+}
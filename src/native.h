@@ -0,0 +1,6 @@
+#ifndef __NATIVE_H__
+#define __NATIVE_H__
+
+void defineNatives();
+
+#endif // !__NATIVE_H__
@@ -0,0 +1,357 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+
+// Numbers are printed with the fewest digits that read back as the same
+// double, found with Grisu3 on 64-bit "do-it-yourself" floating point.
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+#define DIY_SIGNIFICAND 64
+#define DOUBLE_SIGNIFICAND 52
+#define DOUBLE_BIAS 1075
+#define HIDDEN_BIT (1ull << DOUBLE_SIGNIFICAND)
+
+// 10^k for k = -348, -340, ..., 340, normalized and rounded.
+#define CACHED_FIRST (-348)
+#define CACHED_STEP 8
+
+static const uint64_t cached_f[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+    0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+    0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+    0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+    0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+    0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+    0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+    0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+    0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+    0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+    0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+    0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+    0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+    0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+    0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+    0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+    0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+    0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+    0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+    0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+    0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+    0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t cached_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t pow10_int[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+static DiyFp diyFp(double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    uint64_t significand = bits & (HIDDEN_BIT - 1);
+    int biased = (int)((bits >> DOUBLE_SIGNIFICAND) & 0x7ff);
+    if(biased == 0) return (DiyFp){significand, 1 - DOUBLE_BIAS};
+    return (DiyFp){significand + HIDDEN_BIT, biased - DOUBLE_BIAS};
+}
+
+static DiyFp multiply(DiyFp x, DiyFp y) {
+    unsigned __int128 product = (unsigned __int128)x.f * y.f;
+    uint64_t high = (uint64_t)(product >> 64);
+    // Round on the highest dropped bit.
+    high += ((uint64_t)product >> 63) & 1;
+    return (DiyFp){high, x.e + y.e + DIY_SIGNIFICAND};
+}
+
+static DiyFp normalize(DiyFp x) {
+    int shift = __builtin_clzll(x.f);
+    return (DiyFp){x.f << shift, x.e - shift};
+}
+
+// The neighbours halfway to the next doubles down and up, with the
+// exponent of the upper one.
+static void boundaries(DiyFp v, DiyFp* minus, DiyFp* plus) {
+    *plus = normalize((DiyFp){(v.f << 1) + 1, v.e - 1});
+    // The gap below a power of two is half the gap above it.
+    if(v.f == HIDDEN_BIT && v.e > 1 - DOUBLE_BIAS) {
+        *minus = (DiyFp){(v.f << 2) - 1, v.e - 2};
+    } else {
+        *minus = (DiyFp){(v.f << 1) - 1, v.e - 1};
+    }
+    minus->f <<= minus->e - plus->e;
+    minus->e = plus->e;
+}
+
+// A cached 10^-k that brings 'e' into [-60, -32], so the integral part
+// of the product fits 32 bits.
+static DiyFp cachedPower(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if(dk - ik > 0.0) ik++;
+    int index = (ik >> 3) + 1;
+    *k = -(CACHED_FIRST + index * CACHED_STEP);
+    return (DiyFp){cached_f[index], cached_e[index]};
+}
+
+// Walk the last digit down while that stays inside the interval and gets
+// closer to 'w', 'distance' away from the top. False when the error of
+// the scaled values ('unit') leaves the choice or the interval unsure.
+static bool roundDigit(char* buffer, int length, uint64_t distance, uint64_t interval,
+                       uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small = distance - unit;
+    uint64_t big = distance + unit;
+    while(rest < small && interval - rest >= ten_kappa &&
+          (rest + ten_kappa < small || small - rest >= rest + ten_kappa - small)) {
+        buffer[length - 1]--;
+        rest += ten_kappa;
+    }
+    if(rest < big && interval - rest >= ten_kappa &&
+       (rest + ten_kappa < big || big - rest > rest + ten_kappa - big)) {
+        return false;
+    }
+    return 2 * unit <= rest && rest <= interval - 4 * unit;
+}
+
+static int countDigits(uint32_t n) {
+    int count = 1;
+    while(count < 10 && n >= pow10_int[count]) count++;
+    return count;
+}
+
+// Generate the fewest digits inside ('low', 'high') from the top down.
+// The interval is widened by the rounding error, so false means the
+// digits may not be shortest or closest.
+static bool generateDigits(DiyFp low, DiyFp w, DiyFp high, char* buffer, int* length, int* kappa) {
+    uint64_t unit = 1;
+    uint64_t too_high = high.f + unit;
+    uint64_t interval = too_high - (low.f - unit);
+    DiyFp one = {1ull << -w.e, w.e};
+    uint32_t integral = (uint32_t)(too_high >> -one.e);
+    uint64_t fraction = too_high & (one.f - 1);
+    *kappa = countDigits(integral);
+    *length = 0;
+    while(*kappa > 0) {
+        uint32_t divisor = (uint32_t)pow10_int[*kappa - 1];
+        buffer[(*length)++] = (char)('0' + integral / divisor);
+        integral %= divisor;
+        (*kappa)--;
+        uint64_t rest = ((uint64_t)integral << -one.e) + fraction;
+        if(rest < interval) {
+            return roundDigit(buffer, *length, too_high - w.f, interval, rest,
+                              (uint64_t)divisor << -one.e, unit);
+        }
+    }
+    for(;;) {
+        fraction *= 10;
+        unit *= 10;
+        interval *= 10;
+        buffer[(*length)++] = (char)('0' + (fraction >> -one.e));
+        fraction &= one.f - 1;
+        (*kappa)--;
+        if(fraction < interval) {
+            return roundDigit(buffer, *length, (too_high - w.f) * unit, interval, fraction,
+                              one.f, unit);
+        }
+    }
+}
+
+// Grisu3: the digits of 'number' scaled by 10^k, or false for the few
+// numbers it can't decide.
+static bool grisu3(double number, char* buffer, int* length, int* k) {
+    DiyFp v = diyFp(number);
+    DiyFp minus, plus;
+    boundaries(v, &minus, &plus);
+    int mk;
+    DiyFp power = cachedPower(plus.e, &mk);
+    DiyFp w = multiply(normalize(v), power);
+    DiyFp high = multiply(plus, power);
+    DiyFp low = multiply(minus, power);
+    int kappa;
+    bool exact = generateDigits(low, w, high, buffer, length, &kappa);
+    *k = mk + kappa;
+    return exact;
+}
+
+// The slow way: the first precision 'printf' rounds back to 'number'.
+static int shortestPrintf(double number, char* buffer, int* k) {
+    char text[NUMBER_BUFFER];
+    int precision = 1;
+    for(; precision < 17; precision++) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, number);
+        if(strtod(text, NULL) == number) break;
+    }
+    snprintf(text, sizeof(text), "%.*e", precision - 1, number);
+    // "d.ddde[+-]x" to the digits and the power of their last one.
+    int length = 0;
+    char* c = text;
+    for(; *c != 'e'; c++) {
+        if(*c != '.') buffer[length++] = *c;
+    }
+    *k = atoi(c + 1) - (length - 1);
+    while(length > 1 && buffer[length - 1] == '0') {
+        length--;
+        (*k)++;
+    }
+    return length;
+}
+
+static int writeExponent(int exponent, char* buffer) {
+    int length = 0;
+    buffer[length++] = 'e';
+    buffer[length++] = exponent < 0 ? '-' : '+';
+    if(exponent < 0) exponent = -exponent;
+    if(exponent >= 100) buffer[length++] = (char)('0' + exponent / 100);
+    if(exponent >= 10) buffer[length++] = (char)('0' + exponent / 10 % 10);
+    buffer[length++] = (char)('0' + exponent % 10);
+    return length;
+}
+
+// Place the point in the digits of 'digits * 10^k', positional for
+// decimal exponents in (-6, 21] and scientific beyond.
+static int layout(char* buffer, int length, int k) {
+    int point = length + k;
+    if(k >= 0 && point <= 21) {
+        memset(buffer + length, '0', k);
+        return point;
+    }
+    if(point > 0 && point <= 21) {
+        memmove(buffer + point + 1, buffer + point, length - point);
+        buffer[point] = '.';
+        return length + 1;
+    }
+    if(point > -6 && point <= 0) {
+        int zeros = 2 - point;
+        memmove(buffer + zeros, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        memset(buffer + 2, '0', zeros - 2);
+        return length + zeros;
+    }
+    if(length == 1) {
+        return 1 + writeExponent(point - 1, buffer + 1);
+    }
+    memmove(buffer + 2, buffer + 1, length - 1);
+    buffer[1] = '.';
+    return length + 1 + writeExponent(point - 1, buffer + length + 1);
+}
+
+// Write the shortest text that reads back as 'number' and return its
+// length. 'buffer' holds at least 'NUMBER_BUFFER' chars.
+int formatNumber(double number, char* buffer) {
+    if(isnan(number)) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    int sign = signbit(number) ? 1 : 0;
+    if(sign) {
+        buffer[0] = '-';
+        number = -number;
+    }
+    char* digits = buffer + sign;
+    int length;
+    if(isinf(number)) {
+        memcpy(digits, "inf", 3);
+        length = 3;
+    } else if(number == 0) {
+        digits[0] = '0';
+        length = 1;
+    } else {
+        int k;
+        if(!grisu3(number, digits, &length, &k)) {
+            length = shortestPrintf(number, digits, &k);
+        }
+        length = layout(digits, length, k);
+    }
+    digits[length] = '\0';
+    return sign + length;
+}
+
+// Digits only, as the scanner produces them. False if the value doesn't
+// fit an 'int64_t'.
+bool parseInteger(const char* chars, int length, int64_t* integer) {
+    int64_t value = 0;
+    for(int i = 0; i < length; i++) {
+        if(__builtin_mul_overflow(value, 10, &value) ||
+           __builtin_add_overflow(value, chars[i] - '0', &value)) {
+            return false;
+        }
+    }
+    *integer = value;
+    return true;
+}
+
+// Powers of ten a double holds exactly.
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define EXACT_SIGNIFICAND (1ull << 53)
+#define EXACT_POWER 22
+#define FAST_DIGITS 19
+#define PARSE_BUFFER 64
+
+// Digits with an optional fraction. A significand and power of ten that
+// are both exact doubles give the correctly rounded result with one
+// multiply or divide; anything else goes to 'strtod'.
+double parseNumber(const char* chars, int length) {
+    uint64_t significand = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool fraction = false;
+    for(int i = 0; i < length; i++) {
+        if(chars[i] == '.') {
+            fraction = true;
+            continue;
+        }
+        if(fraction) exponent--;
+        if(digits == 0 && chars[i] == '0') continue;
+        if(++digits > FAST_DIGITS) break;
+        significand = significand * 10 + (uint64_t)(chars[i] - '0');
+    }
+    // Trailing zeros of the fraction don't change the value.
+    while(fraction && exponent < 0 && significand != 0 && significand % 10 == 0 && digits <= FAST_DIGITS) {
+        significand /= 10;
+        exponent++;
+    }
+    if(digits <= FAST_DIGITS && significand <= EXACT_SIGNIFICAND) {
+        if(exponent >= 0 && exponent <= EXACT_POWER) return (double)significand * pow10_exact[exponent];
+        if(exponent < 0 && -exponent <= EXACT_POWER) return (double)significand / pow10_exact[-exponent];
+    }
+
+    char local[PARSE_BUFFER];
+    char* text = length < PARSE_BUFFER ? local : (char*)malloc(length + 1);
+    memcpy(text, chars, length);
+    text[length] = '\0';
+    double number = strtod(text, NULL);
+    if(text != local) free(text);
+    return number;
+}
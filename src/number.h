@@ -0,0 +1,14 @@
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Longest text 'formatNumber' writes, with the terminating '\0'.
+#define NUMBER_BUFFER 32
+
+int formatNumber(double number, char* buffer);
+bool parseInteger(const char* chars, int length, int64_t* integer);
+double parseNumber(const char* chars, int length);
+
+#endif // !__NUMBER_H__
@@ -27,6 +27,22 @@ static Obj* allocateObj(ObjType type) {
             res = (Obj*)malloc(sizeof(ObjUpvalue));
             break;
         }
+        case OBJ_NATIVE: {
+            res = (Obj*)malloc(sizeof(ObjNative));
+            break;
+        }
+        case OBJ_LIST: {
+            res = (Obj*)malloc(sizeof(ObjList));
+            break;
+        }
+        case OBJ_MAP: {
+            res = (Obj*)malloc(sizeof(ObjMap));
+            break;
+        }
+        case OBJ_JUMP_TABLE: {
+            res = (Obj*)malloc(sizeof(ObjJumpTable));
+            break;
+        }
     }
     res->type = type;
     res->next = vm.obj_list;
@@ -34,29 +50,27 @@ static Obj* allocateObj(ObjType type) {
     return res;
 }
 
-static uint32_t hashString(const char* initial, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)initial[i];
-        hash *= 16777619;
-    }
-    return hash;
-}
-
 static void freeObject(Obj* obj) {
     switch(obj->type) {
         case OBJ_STRING: {
-            // printf("free '%s'\n", ((ObjString*)obj)->chars);
-            FREE(((ObjString*)obj)->chars, "free ObjString->chars\n");
+            ObjString* str = (ObjString*)obj;
+            if(str->length > STRING_INLINE_MAX && !IS_VIEW(str)) {
+                FREE(str->as.heap.chars, "free ObjString->chars\n");
+            }
             FREE(obj, "free ObjString\n");
             break;
         }
         case OBJ_FUNCTION: {
+            freeLazyBody((ObjFunction*)obj);
+            jitFree(((ObjFunction*)obj)->jit);
             freeRam(&(((ObjFunction*)obj)->ram));
             FREE(obj, "free ObjFunction\n");
             break;
         }
         case OBJ_CLOSURE: {
+            if(((ObjClosure*)obj)->upvalues != NULL) {
+                FREE(((ObjClosure*)obj)->upvalues, "free ObjClosure->upvalues\n");
+            }
             FREE(obj, "free ObjClosure\n") ;
             break;
         }
@@ -65,6 +79,28 @@ static void freeObject(Obj* obj) {
             FREE(obj, "free ObjUpvalue\n") ;
             break;
         }
+        case OBJ_NATIVE: {
+            FREE(obj, "free ObjNative\n");
+            break;
+        }
+        case OBJ_LIST: {
+            freeValueArray(&((ObjList*)obj)->items);
+            FREE(obj, "free ObjList\n");
+            break;
+        }
+        case OBJ_MAP: {
+            freeTable(&((ObjMap*)obj)->table);
+            FREE(obj, "free ObjMap\n");
+            break;
+        }
+        case OBJ_JUMP_TABLE: {
+            ObjJumpTable* table = (ObjJumpTable*)obj;
+            if(table->targets != NULL) FREE(table->targets, "free ObjJumpTable->targets\n");
+            if(table->dense != NULL) FREE(table->dense, "free ObjJumpTable->dense\n");
+            freeTable(&table->sparse);
+            FREE(obj, "free ObjJumpTable\n");
+            break;
+        }
     }
     obj = NULL;
 }
@@ -78,26 +114,122 @@ void freeObjects() {
     }
 }
 
-ObjString* allocateObjString(const char* initial, int length) {
-    uint32_t hash = hashString(initial, length);
-
-    ObjString* str = tableFindString(&vm.strings, initial, length, hash);
-    if(str != NULL) {
-        return str;
+// Hash eight bytes per step, then mix so the low bits used by the
+// table index depend on every input byte. Never 0, which marks a view
+// that hasn't been hashed.
+uint32_t hashString(const char* initial, int length) {
+    uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t)length;
+    int i = 0;
+    for(; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, initial + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    if(i < length) {
+        uint64_t word = 0;
+        memcpy(&word, initial + i, length - i);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
     }
-    str = (ObjString*)allocateObj(OBJ_STRING);
-    str->chars = (char*)malloc(sizeof(char) * (length + 1));
-    strncpy(str->chars, initial, length);
-    str->chars[length] = '\0';
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return (uint32_t)hash == 0 ? 1 : (uint32_t)hash;
+}
+
+static ObjString* newObjString(int length, uint32_t hash) {
+    ObjString* str = (ObjString*)allocateObj(OBJ_STRING);
     str->length = length;
     str->hash_code = hash;
     return str;
 }
 
+static ObjString* addInternedString(Entry* entry, ObjString* str) {
+    entry->key = VALUE_OBJ(str);
+    entry->val = VALUE_NIL;
+    return str;
+}
+
+// Every string is interned, so 'vm.strings' is probed once per creation.
+ObjString* allocateObjStringHashed(const char* initial, int length, uint32_t hash) {
+    Entry* entry = tableFindOrAddString(&vm.strings, initial, length, hash);
+    if(!IS_UNDEFINED(entry->key)) {
+        return AS_STRING(entry->key);
+    }
+    ObjString* str = newObjString(length, hash);
+    char* chars = str->as.inline_chars;
+    if(length > STRING_INLINE_MAX) {
+        chars = (char*)malloc(sizeof(char) * (length + 1));
+        str->as.heap.chars = chars;
+        str->as.heap.parent = NULL;
+    }
+    memcpy(chars, initial, length);
+    chars[length] = '\0';
+    return addInternedString(entry, str);
+}
+
+ObjString* allocateObjString(const char* initial, int length) {
+    return allocateObjStringHashed(initial, length, hashString(initial, length));
+}
+
+// Take ownership of a malloc'ed, '\0' ended 'chars' instead of copying it.
+ObjString* takeObjString(char* chars, int length) {
+    uint32_t hash = hashString(chars, length);
+    Entry* entry = tableFindOrAddString(&vm.strings, chars, length, hash);
+    if(!IS_UNDEFINED(entry->key)) {
+        FREE(chars, "free duplicate chars\n");
+        return AS_STRING(entry->key);
+    }
+    ObjString* str = newObjString(length, hash);
+    if(length > STRING_INLINE_MAX) {
+        str->as.heap.chars = chars;
+        str->as.heap.parent = NULL;
+    } else {
+        memcpy(str->as.inline_chars, chars, length + 1);
+        FREE(chars, "free short chars\n");
+    }
+    return addInternedString(entry, str);
+}
+
+// 'length' chars of 'str' from 'start', without copying them unless they
+// fit inline. Slices of a view share the chars of its parent.
+ObjString* sliceObjString(ObjString* str, int start, int length) {
+    const char* chars = STRING_CHARS(str) + start;
+    if(length <= STRING_INLINE_MAX) {
+        return allocateObjString(chars, length);
+    }
+    if(start == 0 && length == str->length) return str;
+    ObjString* view = newObjString(length, 0);
+    view->as.heap.chars = (char*)chars;
+    view->as.heap.parent = IS_VIEW(str) ? str->as.heap.parent : str;
+    return view;
+}
+
+// The interned string with the chars of 'str', copied from a view the
+// first time one is needed, as when it becomes a key.
+ObjString* internString(ObjString* str) {
+    if(!IS_VIEW(str)) return str;
+    return allocateObjStringHashed(str->as.heap.chars, str->length, stringHash(str));
+}
+
+uint32_t stringHash(ObjString* str) {
+    if(str->hash_code == 0) {
+        str->hash_code = hashString(str->as.heap.chars, str->length);
+    }
+    return str->hash_code;
+}
+
+// Interned strings are equal only if they are the same object.
+bool stringsEqual(ObjString* a, ObjString* b) {
+    if(a == b) return true;
+    if(!IS_VIEW(a) && !IS_VIEW(b)) return false;
+    return a->length == b->length && stringHash(a) == stringHash(b) \
+           && memcmp(STRING_CHARS(a), STRING_CHARS(b), a->length) == 0;
+}
+
 Value allocateString(const char* initial, int length) {
-    ObjString* str = allocateObjString(initial, length);
-    tableSet(&vm.strings, str, VALUE_NIL);
-    return VALUE_OBJ(str);
+    return VALUE_OBJ(allocateObjString(initial, length));
 }
 
 ObjFunction* allocateObjFunction(FunctionType type) {
@@ -107,13 +239,29 @@ ObjFunction* allocateObjFunction(FunctionType type) {
     func->func_name = NULL;
     func->type = type;
     initRam(&func->ram);
+    func->lazy = NULL;
+    func->hotness = 0;
+    func->jit = NULL;
+    func->shared_closure = NULL;
     return func;
 }
 
-ObjClosure* allocateObjClosure(ObjFunction* func) {
+void freeLazyBody(ObjFunction* function) {
+    if(function->lazy == NULL) return;
+    FREE(function->lazy->upvalue_names, "free LazyBody->upvalue_names\n");
+    FREE(function->lazy, "free LazyBody\n");
+    function->lazy = NULL;
+}
+
+// 'copy_count' upvalues are captured by value and closed in place.
+ObjClosure* allocateObjClosure(ObjFunction* func, int copy_count) {
     ObjClosure* closure = (ObjClosure*)allocateObj(OBJ_CLOSURE);
     closure->function = func;
-    closure->upvalues = (ObjUpvalue**)malloc(func->upvalue_count * sizeof(ObjUpvalue*));
+    // The pointers and the storage for copied upvalues share one block.
+    int count = func->upvalue_count;
+    closure->upvalues = count == 0 ? NULL \
+                      : (ObjUpvalue**)malloc(count * sizeof(ObjUpvalue*) + copy_count * sizeof(ObjUpvalue));
+    closure->copies = count == 0 ? NULL : (ObjUpvalue*)(closure->upvalues + count);
     return closure;
 }
 
@@ -124,3 +272,52 @@ ObjUpvalue* allocateObjUpvalue(Value* val) {
     upvalue->next = NULL;
     return upvalue;
 }
+
+ObjNative* allocateObjNative(NativeFn function, ObjString* name, int arity) {
+    ObjNative* native = (ObjNative*)allocateObj(OBJ_NATIVE);
+    native->arity = arity;
+    native->function = function;
+    native->name = name;
+    return native;
+}
+
+// Reserve 'capacity' slots up front so a literal never regrows.
+ObjList* allocateObjList(int capacity) {
+    ObjList* list = (ObjList*)allocateObj(OBJ_LIST);
+    initValueArray(&list->items);
+    if(capacity > 0) {
+        list->items.capacity = capacity;
+        list->items.val = GROW_ARRAY(NULL, Value, 0, capacity);
+    }
+    return list;
+}
+
+ObjMap* allocateObjMap() {
+    ObjMap* map = (ObjMap*)allocateObj(OBJ_MAP);
+    initTable(&map->table);
+    return map;
+}
+
+ObjJumpTable* allocateObjJumpTable() {
+    ObjJumpTable* table = (ObjJumpTable*)allocateObj(OBJ_JUMP_TABLE);
+    table->targets = NULL;
+    table->target_count = 0;
+    table->target_capacity = 0;
+    table->default_target = -1;
+    table->low = 0;
+    table->dense_count = 0;
+    table->dense = NULL;
+    initTable(&table->sparse);
+    return table;
+}
+
+// Return the index of the new target.
+int addJumpTarget(ObjJumpTable* table, int target) {
+    if(table->target_count == table->target_capacity) {
+        int capacity = GROW_CAPACITY(table->target_capacity);
+        table->targets = GROW_ARRAY(table->targets, int, table->target_count, capacity);
+        table->target_capacity = capacity;
+    }
+    table->targets[table->target_count] = target;
+    return table->target_count++;
+}
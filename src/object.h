@@ -2,23 +2,36 @@
 #define __OBJECT_H__
 
 #include <stdint.h>
+#include "jit.h"
 #include "ram.h"
+#include "table.h"
 #include "value.h"
 
 #define AS_STRING(value) ((ObjString*)((value).as.obj))
-#define AS_CSTRING(value) ((char*)(AS_STRING((value))->chars))
+#define AS_CSTRING(value) (STRING_CHARS(AS_STRING((value))))
 #define AS_FUNC(value) ((ObjFunction*)((value).as.obj))
 #define AS_CLOSURE(value) ((ObjClosure*)((value).as.obj))
+#define AS_NATIVE(value) ((ObjNative*)((value).as.obj))
+#define AS_LIST(value) ((ObjList*)((value).as.obj))
+#define AS_MAP(value) ((ObjMap*)((value).as.obj))
+#define AS_JUMP_TABLE(value) ((ObjJumpTable*)((value).as.obj))
 
 #define IS_STRING(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_STRING)
 #define IS_FUNC(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_FUNCTION)
 #define IS_CLOSURE(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_CLOSURE)
+#define IS_NATIVE(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_NATIVE)
+#define IS_LIST(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_LIST)
+#define IS_MAP(value) (IS_OBJ((value)) && (value).as.obj->type == OBJ_MAP)
 
 typedef enum {
     OBJ_STRING,
     OBJ_FUNCTION,
     OBJ_CLOSURE,
     OBJ_UPVALUE,
+    OBJ_NATIVE,
+    OBJ_LIST,
+    OBJ_MAP,
+    OBJ_JUMP_TABLE,
 } ObjType;
 
 struct Obj{
@@ -26,11 +39,29 @@ struct Obj{
     struct Obj* next;
 };
 
+// Strings up to this length are stored inside the object itself.
+#define STRING_INLINE_MAX 15
+
+// Always read the chars through this, never 'as' directly.
+#define STRING_CHARS(str) \
+            ((str)->length <= STRING_INLINE_MAX ? (str)->as.inline_chars : (str)->as.heap.chars)
+
+// A view isn't interned and its chars aren't '\0' ended.
+#define IS_VIEW(str) ((str)->length > STRING_INLINE_MAX && (str)->as.heap.parent != NULL)
+
+// Strings are interned, except views: slices of a longer string that
+// share its chars. A view's 'hash_code' is 0 until 'stringHash' needs it.
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
     uint32_t hash_code;
+    union {
+        struct {
+            char* chars;
+            ObjString* parent;  // The owner of 'chars' for a view, else NULL.
+        } heap;
+        char inline_chars[STRING_INLINE_MAX + 1];
+    } as;
 };
 
 typedef enum {
@@ -38,6 +69,14 @@ typedef enum {
     TYPE_USER,
 } FunctionType;
 
+// Where to find a body that hasn't been compiled yet.
+typedef struct {
+    const char* source;         // From the '(' of the parameters to the last '}'.
+    size_t length;
+    int line;
+    ObjString** upvalue_names;  // The name behind each upvalue.
+} LazyBody;
+
 struct ObjFunction {
     Obj obj;
     int arity;
@@ -45,6 +84,10 @@ struct ObjFunction {
     ObjString* func_name;
     FunctionType type;
     Ram ram;
+    LazyBody* lazy;     // Not NULL until the first call compiles the body.
+    int hotness;        // Calls and back-edges seen, -1 once the JIT gave up.
+    JitCode* jit;       // Native code, NULL until the function gets hot.
+    ObjClosure* shared_closure; // Reused by 'OP_CLOSURE' when nothing is captured.
 };
 
 typedef struct ObjUpvalue {
@@ -58,14 +101,64 @@ struct ObjClosure {
     Obj obj;
     ObjFunction* function;
     ObjUpvalue** upvalues;
+    ObjUpvalue* copies;     // Closed in place for upvalues captured by value.
+};
+
+// Write the result into 'result', return false if the arguments are wrong.
+typedef bool (*NativeFn)(Value* args, Value* result);
+
+struct ObjNative {
+    Obj obj;
+    int arity;
+    NativeFn function;
+    ObjString* name;
+};
+
+// Elements are stored contiguously in 'items'.
+struct ObjList {
+    Obj obj;
+    ValueArray items;
+};
+
+// Keys may be any value, see 'hashValue' in table.c.
+struct ObjMap {
+    Obj obj;
+    Table table;
+};
+
+// The cases of a 'switch', read by 'OP_JUMP_TABLE'. Each case body has one
+// entry in 'targets', which the cases point at by index.
+struct ObjJumpTable {
+    Obj obj;
+    int* targets;       // Offsets from the end of 'OP_JUMP_TABLE'.
+    int target_count;
+    int target_capacity;
+    int default_target;
+    double low;         // The case in 'dense[0]'.
+    int dense_count;
+    int* dense;         // Integral cases from 'low' on, holes go to the default.
+    Table sparse;       // Every other case.
 };
 
 void freeObjects();
+void freeLazyBody(ObjFunction* function);
+uint32_t hashString(const char* initial, int length);
 ObjString* allocateObjString(const char* initial, int length);
+ObjString* allocateObjStringHashed(const char* initial, int length, uint32_t hash);
+ObjString* takeObjString(char* chars, int length);
+ObjString* sliceObjString(ObjString* str, int start, int length);
+ObjString* internString(ObjString* str);
+uint32_t stringHash(ObjString* str);
+bool stringsEqual(ObjString* a, ObjString* b);
 Value allocateString(const char* initial, int length);
 ObjFunction* allocateObjFunction(FunctionType type);
-ObjClosure* allocateObjClosure(ObjFunction* func);
+ObjClosure* allocateObjClosure(ObjFunction* func, int copy_count);
 ObjUpvalue* allocateObjUpvalue(Value* val);
+ObjNative* allocateObjNative(NativeFn function, ObjString* name, int arity);
+ObjList* allocateObjList(int capacity);
+ObjMap* allocateObjMap();
+ObjJumpTable* allocateObjJumpTable();
+int addJumpTarget(ObjJumpTable* table, int target);
 
 #endif // ! __OBJECT_H__
 
@@ -0,0 +1,343 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mem.h"
+#include "object.h"
+#include "optimize.h"
+#include "ram.h"
+#include "vm.h"
+
+// Hops followed when threading a jump, so a cycle of jumps still ends.
+#define THREAD_MAX 16
+
+int instructionLength(Ram* ram, int offset) {
+    switch(ram->code[offset]) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_STORE_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_ARG:
+        case OP_SET_ARG:
+        case OP_LIST:
+        case OP_JUMP_TABLE:
+        case OP_CALL:
+            return 2;
+        case OP_ADD_LL:
+        case OP_SUBTRACT_LL:
+        case OP_MULTIPLY_LL:
+        case OP_DIVIDE_LL:
+        case OP_EQUAL_LL:
+        case OP_GREATER_LL:
+        case OP_LESS_LL:
+        case OP_ADD_LC:
+        case OP_SUBTRACT_LC:
+        case OP_MULTIPLY_LC:
+        case OP_DIVIDE_LC:
+        case OP_EQUAL_LC:
+        case OP_GREATER_LC:
+        case OP_LESS_LC:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP:
+        case OP_BACK_JUMP:
+            return 3;
+        case OP_FOR_PREP:
+        case OP_FOR_ITER:
+        case OP_INLINE_CHECK:
+            return 4;
+        case OP_CLOSURE:
+            return 2 + 2 * AS_FUNC(ram->constants.val[ram->code[offset + 1]])->upvalue_count;
+        default:
+            return 1;
+    }
+}
+
+// The offset a jump instruction lands on, or -1 for other instructions.
+static int jumpTarget(Ram* ram, int offset) {
+    uint8_t* code = ram->code;
+    switch(code[offset]) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP:
+            return offset + 3 + ((code[offset + 2] << 8) + code[offset + 1]);
+        case OP_BACK_JUMP:
+            return offset + 3 - ((code[offset + 2] << 8) + code[offset + 1]);
+        case OP_FOR_PREP:
+        case OP_INLINE_CHECK:
+            return offset + 4 + ((code[offset + 3] << 8) + code[offset + 2]);
+        case OP_FOR_ITER:
+            return offset + 4 - ((code[offset + 3] << 8) + code[offset + 2]);
+        default:
+            return -1;
+    }
+}
+
+// Where the 16-bit operand of a jump instruction is.
+static int jumpOperand(uint8_t op) {
+    return (op == OP_FOR_PREP || op == OP_FOR_ITER || op == OP_INLINE_CHECK) ? 2 : 1;
+}
+
+// The jump table read by the 'OP_JUMP_TABLE' at 'offset', its targets
+// count from the end of the instruction.
+static ObjJumpTable* jumpTable(Ram* ram, int offset) {
+    return AS_JUMP_TABLE(ram->constants.val[ram->code[offset + 1]]);
+}
+
+static void markTableTargets(Ram* ram, int offset, bool* is_target) {
+    ObjJumpTable* table = jumpTable(ram, offset);
+    for(int i = 0; i < table->target_count; i++) {
+        is_target[offset + 2 + table->targets[i]] = true;
+    }
+}
+
+static bool isBinary(uint8_t op) {
+    return op >= OP_ADD && op <= OP_LESS;
+}
+
+// Write the operand of every jump left in 'out' so it lands on the new
+// offset of 'target[offset]'. Unconditional jumps pick their direction.
+static void relocateJumps(Ram* ram, Ram* out, int* new_offset, int* target) {
+    uint8_t* code = ram->code;
+    for(int offset = 0; offset < ram->count; offset += instructionLength(ram, offset)) {
+        if(code[offset] == OP_JUMP_TABLE) {
+            ObjJumpTable* table = jumpTable(ram, offset);
+            for(int i = 0; i < table->target_count; i++) {
+                int old_target = offset + 2 + table->targets[i];
+                table->targets[i] = new_offset[old_target] - (new_offset[offset] + 2);
+            }
+            continue;
+        }
+        if(target[offset] < 0) continue;
+        int at = new_offset[offset];
+        int operand = at + jumpOperand(code[offset]);
+        int distance = new_offset[target[offset]] - (operand + 2);
+        if(code[offset] == OP_JUMP || code[offset] == OP_BACK_JUMP) {
+            out->code[at] = distance < 0 ? OP_BACK_JUMP : OP_JUMP;
+        }
+        if(distance < 0) distance = -distance;
+        out->code[operand] = (uint8_t)distance;
+        out->code[operand + 1] = (uint8_t)(distance >> 8);
+    }
+}
+
+// Move the rewritten code and line table of 'out' into 'ram'.
+static void replaceCode(Ram* ram, Ram* out) {
+    FREE(ram->code, "free ram->code\n");
+    if(ram->lines != NULL) FREE(ram->lines, "free ram->lines\n");
+    ram->code = out->code;
+    ram->count = out->count;
+    ram->capacity = out->capacity;
+    ram->lines = out->lines;
+    ram->line_count = out->line_count;
+    ram->line_capacity = out->line_capacity;
+    out->code = NULL;
+    out->lines = NULL;
+    freeRam(out);
+}
+
+static void emitFused(Ram* fused, Ram* ram, int from, int length, int line) {
+    for(int i = 0; i < length; i++) addCode(fused, ram->code[from + i], line);
+}
+
+// Rewrite stack sequences on locals into register forms:
+//   GET_LOCAL a; GET_LOCAL b; <op>   ->  <op>_LL a b
+//   GET_LOCAL a; CONSTANT k; <op>    ->  <op>_LC a k
+//   SET_LOCAL d; POP                 ->  STORE_LOCAL d
+// No jump may land inside a rewritten sequence, and every jump
+// is retargeted afterwards since the code shrinks.
+void fuseRegisterOps(Ram* ram) {
+    int count = ram->count;
+    bool* is_target = (bool*)calloc(count + 1, sizeof(bool));
+    int* new_offset = (int*)malloc(sizeof(int) * (count + 1));
+    int* target = (int*)malloc(sizeof(int) * (count + 1));
+    for(int offset = 0; offset < count; offset += instructionLength(ram, offset)) {
+        target[offset] = jumpTarget(ram, offset);
+        if(target[offset] >= 0 && target[offset] <= count) is_target[target[offset]] = true;
+        if(ram->code[offset] == OP_JUMP_TABLE) markTableTargets(ram, offset, is_target);
+    }
+
+    Ram fused;
+    initRam(&fused);
+    uint8_t* code = ram->code;
+    int offset = 0;
+    while(offset < count) {
+        int line = getLine(ram, offset);
+        int second = offset + instructionLength(ram, offset);
+        int third = second < count ? second + instructionLength(ram, second) : count;
+        new_offset[offset] = fused.count;
+
+        if(code[offset] == OP_GET_LOCAL && third < count && isBinary(code[third])
+           && (code[second] == OP_GET_LOCAL || code[second] == OP_CONSTANT)
+           && !is_target[second] && !is_target[third]) {
+            uint8_t base = code[second] == OP_GET_LOCAL ? OP_ADD_LL : OP_ADD_LC;
+            addCode(&fused, base + (code[third] - OP_ADD), line);
+            addCode(&fused, code[offset + 1], line);
+            addCode(&fused, code[second + 1], line);
+            new_offset[second] = new_offset[third] = new_offset[offset];
+            offset = third + 1;
+            continue;
+        }
+        if(code[offset] == OP_SET_LOCAL && second < count && code[second] == OP_POP
+           && !is_target[second]) {
+            addCode(&fused, OP_STORE_LOCAL, line);
+            addCode(&fused, code[offset + 1], line);
+            new_offset[second] = new_offset[offset];
+            offset = second + 1;
+            continue;
+        }
+        emitFused(&fused, ram, offset, second - offset, line);
+        offset = second;
+    }
+    new_offset[count] = fused.count;
+
+    // Only plain instructions were fused, so every jump is still there.
+    relocateJumps(ram, &fused, new_offset, target);
+    replaceCode(ram, &fused);
+
+    free(is_target);
+    free(new_offset);
+    free(target);
+}
+
+static bool isUnconditional(uint8_t op) {
+    return op == OP_JUMP || op == OP_BACK_JUMP;
+}
+
+static bool isConditional(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+// Follow the jump at 'offset' through the jumps it lands on. A conditional
+// jump leaves its condition on the stack, so one landing on a test of the
+// same sense takes it too, and one landing on the opposite test falls through.
+static int finalTarget(Ram* ram, int* target, int offset) {
+    uint8_t* code = ram->code;
+    uint8_t op = code[offset];
+    int to = target[offset];
+    for(int hops = 0; hops < THREAD_MAX && to < ram->count && to != offset; hops++) {
+        if(isUnconditional(code[to]) || (isConditional(op) && code[to] == op)) {
+            to = target[to];
+        } else if(isConditional(op) && isConditional(code[to])) {
+            to = to + 3;
+        } else {
+            break;
+        }
+    }
+    return to;
+}
+
+// A case body that is only a jump, like an empty one, dispatches
+// straight to where that jump goes.
+static void threadTable(Ram* ram, int* target, int offset) {
+    ObjJumpTable* table = jumpTable(ram, offset);
+    int base = offset + 2;
+    for(int i = 0; i < table->target_count; i++) {
+        int to = base + table->targets[i];
+        for(int hops = 0; hops < THREAD_MAX && to < ram->count && isUnconditional(ram->code[to]); hops++) {
+            to = target[to];
+        }
+        table->targets[i] = to - base;
+    }
+}
+
+// Whether the jump at 'offset' may be pointed at 'to': conditional and
+// loop jumps keep their direction, and the distance must fit 16 bits.
+static bool canRetarget(Ram* ram, int offset, int to) {
+    uint8_t op = ram->code[offset];
+    int from = offset + jumpOperand(op) + 2;
+    if(op == OP_FOR_ITER) {
+        if(to > from) return false;
+    } else if(!isUnconditional(op) && to < from) {
+        return false;
+    }
+    int distance = to - from;
+    if(distance < 0) distance = -distance;
+    return distance <= UINT16_MAX;
+}
+
+// The first instruction from 'offset' on that is still emitted.
+static int landing(Ram* ram, bool* removed, int offset) {
+    while(offset < ram->count && removed[offset]) {
+        offset += instructionLength(ram, offset);
+    }
+    return offset;
+}
+
+// Clean up the control flow the single pass compiler leaves behind:
+//   jumps landing on jumps are threaded to where control finally goes,
+//   JUMP_IF_* a; JUMP b; a:   ->  JUMP_IF_<opposite> b
+//   jumps to the next instruction are dropped.
+// Offsets shrink afterwards, so every jump is retargeted.
+void threadJumps(Ram* ram) {
+    int count = ram->count;
+    uint8_t* code = ram->code;
+    int* target = (int*)malloc(sizeof(int) * (count + 1));
+    int* new_offset = (int*)malloc(sizeof(int) * (count + 1));
+    int* starts = (int*)malloc(sizeof(int) * (count + 1));
+    bool* is_target = (bool*)calloc(count + 1, sizeof(bool));
+    bool* removed = (bool*)calloc(count + 1, sizeof(bool));
+    int start_count = 0;
+    for(int offset = 0; offset < count; offset += instructionLength(ram, offset)) {
+        starts[start_count++] = offset;
+        target[offset] = jumpTarget(ram, offset);
+    }
+
+    for(int i = 0; i < start_count; i++) {
+        int offset = starts[i];
+        if(code[offset] == OP_JUMP_TABLE) threadTable(ram, target, offset);
+        if(target[offset] < 0) continue;
+        int to = finalTarget(ram, target, offset);
+        if(canRetarget(ram, offset, to)) target[offset] = to;
+    }
+    for(int i = 0; i < start_count; i++) {
+        if(target[starts[i]] >= 0) is_target[target[starts[i]]] = true;
+        if(code[starts[i]] == OP_JUMP_TABLE) markTableTargets(ram, starts[i], is_target);
+    }
+
+    // Backwards, so whatever follows a jump is already settled.
+    for(int i = start_count - 1; i >= 0; i--) {
+        int offset = starts[i];
+        uint8_t op = code[offset];
+        if(!isUnconditional(op) && !isConditional(op)) continue;
+        int next = landing(ram, removed, offset + 3);
+        if(target[offset] > offset && landing(ram, removed, target[offset]) == next) {
+            removed[offset] = true;
+            continue;
+        }
+        if(isConditional(op) && next < count && isUnconditional(code[next]) && !is_target[next]
+           && landing(ram, removed, target[offset]) == landing(ram, removed, next + 3)
+           && canRetarget(ram, offset, target[next])) {
+            code[offset] = op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+            target[offset] = target[next];
+            removed[next] = true;
+        }
+    }
+
+    Ram threaded;
+    initRam(&threaded);
+    for(int i = 0; i < start_count; i++) {
+        int offset = starts[i];
+        new_offset[offset] = threaded.count;
+        if(removed[offset]) {
+            target[offset] = -1;
+            continue;
+        }
+        emitFused(&threaded, ram, offset, instructionLength(ram, offset), getLine(ram, offset));
+    }
+    new_offset[count] = threaded.count;
+
+    relocateJumps(ram, &threaded, new_offset, target);
+    replaceCode(ram, &threaded);
+
+    free(target);
+    free(new_offset);
+    free(starts);
+    free(is_target);
+    free(removed);
+}
@@ -0,0 +1,10 @@
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include "ram.h"
+
+int instructionLength(Ram* ram, int offset);
+void fuseRegisterOps(Ram* ram);
+void threadJumps(Ram* ram);
+
+#endif // !__OPTIMIZE_H__
@@ -1,8 +1,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ram.h"
 #include "mem.h"
+#include "table.h"
 #include "value.h"
 
 void initRam(Ram* ram) {
@@ -10,26 +12,93 @@ void initRam(Ram* ram) {
     ram->capacity = 0;
     ram->code = NULL;
     initValueArray(&ram->constants);
+    initTable(&ram->constant_index);
+    initTable(&ram->double_index);
+    ram->line_count = 0;
+    ram->line_capacity = 0;
+    ram->lines = NULL;
+    ram->global_cache = NULL;
 }
 
 void freeRam(Ram* ram) {
     if(ram->code != NULL) {
         FREE(ram->code, "free ram->code\n");
     }
+    if(ram->lines != NULL) {
+        FREE(ram->lines, "free ram->lines\n");
+    }
+    if(ram->global_cache != NULL) {
+        FREE(ram->global_cache, "free ram->global_cache\n");
+    }
     freeValueArray(&ram->constants);
+    freeTable(&ram->constant_index);
+    freeTable(&ram->double_index);
 }
 
-void addCode(Ram* ram, uint8_t code) {
+void addCode(Ram* ram, uint8_t code, int line) {
     if(ram->count == ram->capacity) {
         ram->capacity = GROW_CAPACITY(ram->capacity);
         ram->code = GROW_ARRAY(ram->code, uint8_t, ram->count, ram->capacity);
     }
     ram->code[ram->count] = code;
+
+    // Only start a new run when the line changes.
+    if(ram->line_count == 0 || ram->lines[ram->line_count - 1].line != line) {
+        if(ram->line_count == ram->line_capacity) {
+            ram->line_capacity = GROW_CAPACITY(ram->line_capacity);
+            ram->lines = GROW_ARRAY(ram->lines, LineStart, ram->line_count, ram->line_capacity);
+        }
+        LineStart* start = &ram->lines[ram->line_count];
+        start->offset = ram->count;
+        start->line = line;
+        ram->line_count++;
+    }
     ram->count++;
 }
 
+// Equal numbers, booleans, nil and interned strings share one slot.
+// 1 and 1.0 are the same table key but not the same constant, so doubles
+// are looked up by their bits in an index of their own.
 int addConstant(Ram* ram, Value val) {
+    Table* table = &ram->constant_index;
+    Value key = val;
+    if(IS_NUMBER(val)) {
+        int64_t bits;
+        memcpy(&bits, &val.as.number, sizeof(bits));
+        table = &ram->double_index;
+        key = VALUE_INT(bits);
+    }
+    Value index;
+    if(tableGetValue(table, key, &index)) {
+        return (int)AS_NUMBER(index);
+    }
     addOne(&ram->constants, val);
+    tableSetValue(table, key, VALUE_NUMBER(ram->constants.count - 1));
     return ram->constants.count - 1;
 }
 
+
+// Binary search the run which contains 'offset'.
+int getLine(Ram* ram, int offset) {
+    int low = 0;
+    int high = ram->line_count - 1;
+    if(high < 0) return 0;
+
+    while(low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if(ram->lines[mid].offset > offset) {
+            high = mid - 1;
+        } else {
+            low = mid;
+        }
+    }
+    return ram->lines[low].line;
+}
+
+// Give every instruction an empty cache slot once the code is final.
+void initGlobalCache(Ram* ram) {
+    if(ram->global_cache != NULL) {
+        FREE(ram->global_cache, "free ram->global_cache\n");
+    }
+    ram->global_cache = (EntryCache*)calloc(ram->count, sizeof(EntryCache));
+}
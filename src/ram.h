@@ -2,19 +2,35 @@
 #define __RAM_H__
 
 #include <stdint.h>
+#include "table.h"
 #include "value.h"
 
+// One run of bytecode compiled from the same source line,
+// starting at 'offset' and lasting until the next run begins.
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
 typedef struct {
     int count; 
     int capacity;
     uint8_t* code; 
     ValueArray constants;
+    Table constant_index;   // Constant value -> its index in 'constants'.
+    Table double_index;     // The same for doubles, keyed by their bits.
+    int line_count;
+    int line_capacity;
+    LineStart* lines;   // Run-length encoded (offset, line) table.
+    EntryCache* global_cache;   // Indexed by the offset of a global access.
 } Ram;
 
 void initRam(Ram* ram);
 void freeRam(Ram* ram);
-void addCode(Ram* ram, uint8_t code);
+void addCode(Ram* ram, uint8_t code, int line);
 int addConstant(Ram* ram, Value val);
+int getLine(Ram* ram, int offset);
+void initGlobalCache(Ram* ram);
 
 #endif // !__RAM_H__
 
@@ -1,12 +1,17 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "scanner.h"
 
 typedef struct {
     const char* start;
     const char* current;
+    const char* end;
     int line;
 } Scanner;
 
@@ -117,6 +122,50 @@ void printToken(Token* token) {
             printf("TOKEN_COMMA");
             break;
         }
+        case TOKEN_LEFT_BRACKET: {
+            printf("TOKEN_LEFT_BRACKET");
+            break;
+        }
+        case TOKEN_RIGHT_BRACKET: {
+            printf("TOKEN_RIGHT_BRACKET");
+            break;
+        }
+        case TOKEN_COLON: {
+            printf("TOKEN_COLON");
+            break;
+        }
+        case TOKEN_DOT_DOT: {
+            printf("TOKEN_DOT_DOT");
+            break;
+        }
+        case TOKEN_MODULO: {
+            printf("TOKEN_MODULO");
+            break;
+        }
+        case TOKEN_BIT_AND: {
+            printf("TOKEN_BIT_AND");
+            break;
+        }
+        case TOKEN_BIT_OR: {
+            printf("TOKEN_BIT_OR");
+            break;
+        }
+        case TOKEN_BIT_XOR: {
+            printf("TOKEN_BIT_XOR");
+            break;
+        }
+        case TOKEN_BIT_NOT: {
+            printf("TOKEN_BIT_NOT");
+            break;
+        }
+        case TOKEN_SHIFT_LEFT: {
+            printf("TOKEN_SHIFT_LEFT");
+            break;
+        }
+        case TOKEN_SHIFT_RIGHT: {
+            printf("TOKEN_SHIFT_RIGHT");
+            break;
+        }
         case TOKEN_PRINT: {
             printf("TOKEN_PRINT");
             break;
@@ -149,6 +198,14 @@ void printToken(Token* token) {
             printf("TOKEN_WHILE");
             break;
         }
+        case TOKEN_FOR: {
+            printf("TOKEN_FOR");
+            break;
+        }
+        case TOKEN_IN: {
+            printf("TOKEN_IN");
+            break;
+        }
         case TOKEN_FUNC: {
             printf("TOKEN_FUNC");
             break;
@@ -157,6 +214,18 @@ void printToken(Token* token) {
             printf("TOKEN_RETURN");
             break;
         }
+        case TOKEN_SWITCH: {
+            printf("TOKEN_SWITCH");
+            break;
+        }
+        case TOKEN_CASE: {
+            printf("TOKEN_CASE");
+            break;
+        }
+        case TOKEN_DEFAULT: {
+            printf("TOKEN_DEFAULT");
+            break;
+        }
         case TOKEN_SEMICOLON: {
             printf("TOKEN_SEMICOLON");
             break;
@@ -174,20 +243,92 @@ void printToken(Token* token) {
     
 }
 
-void initScanner(const char* source) {
+#define CHAR_DIGIT  0x01
+#define CHAR_ALPHA  0x02    // Letters and '_'.
+#define CHAR_SPACE  0x04
+
+static uint8_t char_class[256];
+
+static void initCharClass() {
+    static bool is_ready = false;
+    if(is_ready) return;
+    for(int ch = '0'; ch <= '9'; ch++) char_class[ch] |= CHAR_DIGIT;
+    for(int ch = 'a'; ch <= 'z'; ch++) char_class[ch] |= CHAR_ALPHA;
+    for(int ch = 'A'; ch <= 'Z'; ch++) char_class[ch] |= CHAR_ALPHA;
+    char_class['_'] |= CHAR_ALPHA;
+    char_class[' '] |= CHAR_SPACE;
+    char_class['\t'] |= CHAR_SPACE;
+    char_class['\r'] |= CHAR_SPACE;
+    char_class['\n'] |= CHAR_SPACE;
+    is_ready = true;
+}
+
+#define IS_CLASS(ch, class) (char_class[(uint8_t)(ch)] & (class))
+
+typedef struct {
+    const char* word;
+    int length;
+    TokenType type;
+} Keyword;
+
+// Every keyword gets its own slot from its first char, last char and length.
+// If a keyword is added, re-pick the multiplier so no two share a slot.
+#define KEYWORD_SLOT(first, last, length) \
+            (((uint8_t)(first) + (uint8_t)(last) * 11 + (length) * 4) & 31)
+
+static const Keyword keywords[32] = {
+    [KEYWORD_SLOT('a', 'd', 3)] = { "and",      3, TOKEN_AND },
+    [KEYWORD_SLOT('c', 'e', 4)] = { "case",     4, TOKEN_CASE },
+    [KEYWORD_SLOT('d', 't', 7)] = { "default",  7, TOKEN_DEFAULT },
+    [KEYWORD_SLOT('d', 'f', 3)] = { "def",      3, TOKEN_FUNC },
+    [KEYWORD_SLOT('e', 'e', 4)] = { "else",     4, TOKEN_ELSE },
+    [KEYWORD_SLOT('e', 'f', 4)] = { "elif",     4, TOKEN_ELIF },
+    [KEYWORD_SLOT('f', 'e', 5)] = { "false",    5, TOKEN_FALSE },
+    [KEYWORD_SLOT('f', 'r', 3)] = { "for",      3, TOKEN_FOR },
+    [KEYWORD_SLOT('i', 'f', 2)] = { "if",       2, TOKEN_IF },
+    [KEYWORD_SLOT('i', 'n', 2)] = { "in",       2, TOKEN_IN },
+    [KEYWORD_SLOT('n', 'l', 3)] = { "nil",      3, TOKEN_NIL },
+    [KEYWORD_SLOT('o', 'r', 2)] = { "or",       2, TOKEN_OR },
+    [KEYWORD_SLOT('p', 't', 5)] = { "print",    5, TOKEN_PRINT },
+    [KEYWORD_SLOT('r', 'n', 6)] = { "return",   6, TOKEN_RETURN },
+    [KEYWORD_SLOT('s', 'h', 6)] = { "switch",   6, TOKEN_SWITCH },
+    [KEYWORD_SLOT('t', 'e', 4)] = { "true",     4, TOKEN_TRUE },
+    [KEYWORD_SLOT('v', 'r', 3)] = { "var",      3, TOKEN_VAR },
+    [KEYWORD_SLOT('w', 'e', 5)] = { "while",    5, TOKEN_WHILE },
+};
+
+// The source doesn't need a trailing '\0', every read is bounded by 'end'.
+void initScanner(const char* source, size_t length) {
+    initCharClass();
     scanner.start = source;
     scanner.current = source;
+    scanner.end = source + length;
     scanner.line = 1;
 }
 
+// Scan a piece of a source again, starting at 'line'.
+void resumeScanner(const char* source, size_t length, int line) {
+    initScanner(source, length);
+    scanner.line = line;
+}
+
 static int isAtEnd() {
-   return *(scanner.start) == '\0';
+   return scanner.start >= scanner.end;
+}
+
+// Return '\0' past the end, which no char class or token accepts.
+static char peek() {
+    return scanner.current < scanner.end ? *scanner.current : '\0';
+}
+
+static char peekNext() {
+    return scanner.current + 1 < scanner.end ? scanner.current[1] : '\0';
 }
 
 static char advance() {
     scanner.start = scanner.current; 
     scanner.current++;
-    return *scanner.start;
+    return isAtEnd() ? '\0' : *scanner.start;
 }
 
 static Token makeToken(TokenType type) {
@@ -204,174 +345,151 @@ static Token errorToken(const char* mes) {
     return token;
 }
 
+#ifdef __SSE2__
+// Bit i is set if byte i of 'chunk' is a letter, digit or '_'.
+static int identifierMask(__m128i chunk) {
+    __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+    __m128i under = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under));
+}
+
+// Bit i is set if byte i of 'chunk' is ' ', '\t', '\r' or '\n'.
+static int spaceMask(__m128i chunk, int* newline_mask) {
+    __m128i newline = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')),
+                                 _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+    *newline_mask = _mm_movemask_epi8(newline);
+    return _mm_movemask_epi8(_mm_or_si128(space, newline));
+}
+
+// Bit i is set if byte i of 'chunk' ends a string body.
+static int stringEndMask(__m128i chunk) {
+    __m128i end = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\"')),
+                  _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')),
+                  _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')),
+                               _mm_cmpeq_epi8(chunk, _mm_setzero_si128()))));
+    return _mm_movemask_epi8(end);
+}
+#endif
+
+// Most runs are a few chars, so the SIMD loops only take over after
+// SHORT_RUN chars. They only load whole chunks before 'scanner.end',
+// and the scalar loops finish the tail.
+#define SHORT_RUN 8
+
 static void skipWhitespace() {
-    for(;;) {
-        char ch = *scanner.current;
-        if(ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
-            if(ch == '\n') {
-                scanner.line++;
-            }
-            scanner.current++;
+    for(int i = 0; i < SHORT_RUN; i++) {
+        char ch = peek();
+        if(!IS_CLASS(ch, CHAR_SPACE)) return;
+        if(ch == '\n') scanner.line++;
+        scanner.current++;
+    }
+#ifdef __SSE2__
+    while(scanner.end - scanner.current >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)scanner.current);
+        int newline_mask;
+        int space_mask = spaceMask(chunk, &newline_mask);
+        if(space_mask == 0xffff) {
+            scanner.line += __builtin_popcount(newline_mask);
+            scanner.current += 16;
             continue;
         }
-        break;
+        int run = __builtin_ctz(~space_mask);
+        scanner.line += __builtin_popcount(newline_mask & ((1 << run) - 1));
+        scanner.current += run;
+        return;
+    }
+#endif
+    while(IS_CLASS(peek(), CHAR_SPACE)) {
+        if(*scanner.current == '\n') {
+            scanner.line++;
+        }
+        scanner.current++;
     }
 }
 
 static int isDigit(const char ch) {
-    return (ch >= '0' && ch <= '9');
+    return IS_CLASS(ch, CHAR_DIGIT);
 }
 
 static int isLetter(const char ch) {
-    return ((ch == '_') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'));
+    return IS_CLASS(ch, CHAR_ALPHA);
 }
 
 // Something unreasonable.
 static Token number() {
     if(*scanner.start != '0') {
-        for(;;) {
-            char ch = *scanner.current;
-            if(!isDigit(ch)) {
-                break;
-            }
+        while(isDigit(peek())) {
             scanner.current++;
         }
     }
-    if(*(scanner.current) == '.') {
-        if(isDigit(*(scanner.current + 1))) {
+    if(peek() == '.' && isDigit(peekNext())) {
+        scanner.current++;
+        while(isDigit(peek())) {
             scanner.current++;
-            for(;;) {
-                char ch = *(scanner.current);
-                if(!isDigit(ch)) {
-                    break;
-                }
-                scanner.current++;
-            }
         }
     }
     return makeToken(TOKEN_NUMBER);
 }
 
-static Token variableName() {
-    for(;;) {
-        char ch = *scanner.current;
-        if(!isLetter(ch) && !isDigit(ch)) {
-            break;
-        }
-        scanner.current++;
+static TokenType identifierType() {
+    int length = scanner.current - scanner.start;
+    const Keyword* keyword = &keywords[KEYWORD_SLOT(scanner.start[0], scanner.current[-1], length)];
+    if(keyword->length == length && memcmp(scanner.start, keyword->word, length) == 0) {
+        return keyword->type;
     }
-    return makeToken(TOKEN_IDENTIFIER);
+    return TOKEN_IDENTIFIER;
 }
 
-bool checkKeyWord(int length, const char* word) {
-    if(strncmp(scanner.current, word, length) == 0) {
-        return true;
+static Token identifier() {
+    for(int i = 0; i < SHORT_RUN; i++) {
+        if(!IS_CLASS(peek(), CHAR_ALPHA | CHAR_DIGIT)) {
+            return makeToken(identifierType());
+        }
+        scanner.current++;
     }
-    return false;
+#ifdef __SSE2__
+    while(scanner.end - scanner.current >= 16) {
+        int mask = identifierMask(_mm_loadu_si128((const __m128i*)scanner.current));
+        if(mask != 0xffff) {
+            scanner.current += __builtin_ctz(~mask);
+            return makeToken(identifierType());
+        }
+        scanner.current += 16;
+    }
+#endif
+    while(IS_CLASS(peek(), CHAR_ALPHA | CHAR_DIGIT)) {
+        scanner.current++;
+    }
+    return makeToken(identifierType());
 }
 
-static Token identifier() {
-    if(*scanner.start == '_') {
-        return variableName();
+static Token string() {
+    for(int i = 0; i < SHORT_RUN && peek() != '\"'; i++) {
+        char ch = peek();
+        if(ch == '\0' || ch == '\r' || ch == '\n') break;
+        scanner.current++;
     }
-    char ch = *scanner.start;
-    switch(ch) {
-        case 'a': {
-            if(checkKeyWord(2, "nd")) {
-                scanner.current += 2;
-                return makeToken(TOKEN_AND);
-            }
-            break;
-        }
-        case 'd': {
-            if(checkKeyWord(2, "ef")) {
-                scanner.current += 2;
-                return makeToken(TOKEN_FUNC);
-            }
-            break;
-        }
-        case 'e': {
-            if(checkKeyWord(3, "lse")) {
-                scanner.current += 3;
-                return makeToken(TOKEN_ELSE);
-            } else if(checkKeyWord(3, "lif")) {
-                scanner.current += 3;
-                return makeToken(TOKEN_ELIF);
-            }
-            break;
-        }
-        case 'f': {
-            if(checkKeyWord(4, "alse")) {
-                scanner.current += 4;
-                return makeToken(TOKEN_FALSE);
-            }
-            break;
-        }
-        case 'i': {
-            if(checkKeyWord(1, "f")) {
-                scanner.current += 1;
-                return makeToken(TOKEN_IF);
-            }
-            break;
-        }
-        case 'n': {
-            if(checkKeyWord(2, "il")) {
-                scanner.current += 2;
-                return makeToken(TOKEN_NIL);
-            }
-            break;
-        }
-        case 'o': {
-            if(checkKeyWord(1, "r")) {
-                scanner.current += 1;
-                return makeToken(TOKEN_OR);
-            }
-            break;
-        }
-        case 'p': {
-            if(checkKeyWord(4, "rint")) {
-                scanner.current += 4;
-                return makeToken(TOKEN_PRINT);
-            }
-            break;
-        }
-        case 'r': {
-            if(checkKeyWord(5, "eturn")) {
-                scanner.current += 5;
-                return makeToken(TOKEN_RETURN);
-            }
-        }
-        case 't': {
-            if(checkKeyWord(3, "rue")) {
-                scanner.current += 3;
-                return makeToken(TOKEN_TRUE);
-            }
-            break;
-        }
-        case 'v': {
-            if(checkKeyWord(2, "ar")) {
-                scanner.current += 2;
-                return makeToken(TOKEN_VAR);
-            }
-            break;
-        }
-        case 'w': {
-            if(checkKeyWord(4, "hile")) {
-                scanner.current += 4;
-                return makeToken(TOKEN_WHILE);
-            }
+#ifdef __SSE2__
+    while(scanner.end - scanner.current >= 16 && *scanner.current != '\"') {
+        int mask = stringEndMask(_mm_loadu_si128((const __m128i*)scanner.current));
+        if(mask != 0) {
+            scanner.current += __builtin_ctz(mask);
             break;
         }
+        scanner.current += 16;
     }
-    // return errorToken("I think this has no possibility to happen.\n");
-    return variableName();
-}
-
-static Token string() {
-    while(*scanner.current != '\"') {
-        if(*scanner.current == '\0' || *scanner.current == '\r' || *scanner.current == '\n') {
+#endif
+    while(peek() != '\"') {
+        char ch = peek();
+        if(ch == '\0' || ch == '\r' || ch == '\n') {
             Token token = errorToken("Unterminated string.");
-            if(*scanner.current == '\r') scanner.current++;
+            if(ch == '\r') scanner.current++;
             return token;
         }
         scanner.current++;
@@ -386,6 +504,7 @@ Token scanToken() {
     skipWhitespace();
     char ch = advance();
     if(isAtEnd()) {
+        scanner.current = scanner.start;
         return makeToken(TOKEN_EOF);
     }
     if(isDigit(ch)) {
@@ -405,15 +524,30 @@ Token scanToken() {
         case '{': return makeToken(TOKEN_LEFT_BRACE);
         case '}': return makeToken(TOKEN_RIGHT_BRACE);
         case ',': return makeToken(TOKEN_COMMA);
+        case '[': return makeToken(TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(TOKEN_RIGHT_BRACKET);
+        case ':': return makeToken(TOKEN_COLON);
+        case '%': return makeToken(TOKEN_MODULO);
+        case '&': return makeToken(TOKEN_BIT_AND);
+        case '|': return makeToken(TOKEN_BIT_OR);
+        case '^': return makeToken(TOKEN_BIT_XOR);
+        case '~': return makeToken(TOKEN_BIT_NOT);
+        case '.': {
+            if(peek() == '.') {
+                scanner.current++;
+                return makeToken(TOKEN_DOT_DOT);
+            }
+            return makeToken(TOKEN_ERROR);
+        }
         case '!': {
-            if(*scanner.current == '=') {
+            if(peek() == '=') {
                 scanner.current++;
                 return makeToken(TOKEN_BANG_EQUAL);
             }
             return makeToken(TOKEN_BANG);
         }
         case '=': {
-            if(*scanner.current == '=') {
+            if(peek() == '=') {
                 scanner.current++;
                 return makeToken(TOKEN_EQUAL_EQUAL);
             } else {
@@ -421,17 +555,25 @@ Token scanToken() {
             }
         }
         case '>': {
-            if(*scanner.current == '=') {
+            if(peek() == '=') {
                 scanner.current++;
                 return makeToken(TOKEN_GREATER_EQUAL);
             }
+            if(peek() == '>') {
+                scanner.current++;
+                return makeToken(TOKEN_SHIFT_RIGHT);
+            }
             return makeToken(TOKEN_GREATER);
         }
         case '<': {
-            if(*scanner.current == '=') {
+            if(peek() == '=') {
                 scanner.current++;
                 return makeToken(TOKEN_LESS_EQUAL);
             }
+            if(peek() == '<') {
+                scanner.current++;
+                return makeToken(TOKEN_SHIFT_LEFT);
+            }
             return makeToken(TOKEN_LESS);
         }
         case ';': return makeToken(TOKEN_SEMICOLON);
@@ -1,6 +1,8 @@
 #ifndef __SCANNER_H__
 #define __SCANNER_H__
 
+#include <stddef.h>
+
 typedef enum {
     TOKEN_ERROR,
 
@@ -28,6 +30,17 @@ typedef enum {
     TOKEN_LEFT_BRACE,   // {
     TOKEN_RIGHT_BRACE,  // }
     TOKEN_COMMA,        // ,
+    TOKEN_LEFT_BRACKET, // [
+    TOKEN_RIGHT_BRACKET,// ]
+    TOKEN_COLON,        // :
+    TOKEN_DOT_DOT,      // ..
+    TOKEN_MODULO,       // %
+    TOKEN_BIT_AND,      // &
+    TOKEN_BIT_OR,       // |
+    TOKEN_BIT_XOR,      // ^
+    TOKEN_BIT_NOT,      // ~
+    TOKEN_SHIFT_LEFT,   // <<
+    TOKEN_SHIFT_RIGHT,  // >>
 
     TOKEN_PRINT,
     TOKEN_VAR,
@@ -37,8 +50,13 @@ typedef enum {
     TOKEN_AND,
     TOKEN_OR,
     TOKEN_WHILE,
+    TOKEN_FOR,
+    TOKEN_IN,
     TOKEN_FUNC,
     TOKEN_RETURN,
+    TOKEN_SWITCH,
+    TOKEN_CASE,
+    TOKEN_DEFAULT,
 
     TOKEN_SEMICOLON,    // ;
 
@@ -52,7 +70,8 @@ typedef struct {
     int line;
 } Token;
 
-void initScanner(const char* source);
+void initScanner(const char* source, size_t length);
+void resumeScanner(const char* source, size_t length, int line);
 Token scanToken();
 void printToken(Token* token);
 
@@ -8,28 +8,96 @@
 
 #define MAX_LOAD 0.75
 
-#define IS_TOMBSTONE(entry) (entry->key == NULL && entry->val.type == BOOLEAN && entry->val.as.boolean == true)
-#define IS_EMPTY_ENTRY(entry) (entry->key == NULL && entry->val.type == NIL)
+#define IS_UNUSED(entry) (IS_UNDEFINED(entry->key))
+#define IS_TOMBSTONE(entry) (IS_UNUSED(entry) && entry->val.type == BOOLEAN && entry->val.as.boolean == true)
+#define IS_EMPTY_ENTRY(entry) (IS_UNUSED(entry) && entry->val.type == NIL)
 #define SET_TOMBSTONE(entry) \
                     do { \
-                        entry->key = NULL; \
+                        entry->key = VALUE_UNDEFINED; \
                         entry->val = VALUE_BOOLEAN(true); \
                     } while(0)
 
 
+// Version 0 is never used, so a zeroed 'EntryCache' always misses.
 void initTable(Table* table) {
     table->count = 0;
     table->capacity = 0;
     table->entry = NULL;
+    table->version = 1;
 }
 
 void freeTable(Table* table) {
     if(table->entry) FREE(table->entry, "free table->entry\n");
+    uint32_t version = table->version;
     initTable(table);
+    table->version = version + 1;
 }
 
-static Entry* findEntry(Entry* src_entry, ObjString* key, int capacity) {
-    int index = key->hash_code % capacity;
+static uint32_t mixBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hashInt(int64_t num) {
+    return mixBits((uint64_t)num);
+}
+
+static bool isIntegral(double num) {
+    return num >= -9223372036854775808.0 && num < 9223372036854775808.0 && num == (int64_t)num;
+}
+
+// A double equal to an integer is the same key as that integer,
+// which also makes -0 and 0 the same key.
+static uint32_t hashNumber(double num) {
+    if(isIntegral(num)) return hashInt((int64_t)num);
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    return mixBits(bits);
+}
+
+static uint32_t hashValue(Value key) {
+    switch(key.type) {
+        case NIL:       return 0x9e3779b9u;
+        case BOOLEAN:   return AS_BOOLEAN(key) ? 0x85ebca6bu : 0xc2b2ae35u;
+        case NUMBER:    return hashNumber(AS_NUMBER(key));
+        case INT:       return hashInt(AS_INT(key));
+        case OBJ: {
+            // Strings are keyed by their chars, other objects by identity.
+            if(IS_STRING(key)) return stringHash(AS_STRING(key));
+            uintptr_t address = (uintptr_t)key.as.obj;
+            return (uint32_t)(address >> 4) ^ (uint32_t)(address >> 32);
+        }
+        default:        return 0;
+    }
+}
+
+// Exact, unlike comparing the integer as a double.
+static bool numbersEqual(Value a, Value b) {
+    if(IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+    if(IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
+    int64_t integer = IS_INT(a) ? AS_INT(a) : AS_INT(b);
+    double num = IS_INT(a) ? AS_NUMBER(b) : AS_NUMBER(a);
+    return isIntegral(num) && (int64_t)num == integer;
+}
+
+static bool keysEqual(Value a, Value b) {
+    if(IS_NUMERIC(a) && IS_NUMERIC(b)) return numbersEqual(a, b);
+    if(a.type != b.type) return false;
+    switch(a.type) {
+        case NIL:       return true;
+        case BOOLEAN:   return AS_BOOLEAN(a) == AS_BOOLEAN(b);
+        case OBJ: {
+            if(a.as.obj == b.as.obj) return true;
+            return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
+        }
+        default:        return false;
+    }
+}
+
+static Entry* findEntry(Entry* src_entry, Value key, int capacity) {
+    int index = hashValue(key) % capacity;
 
     Entry* tombstone = NULL;
     for(;;) {
@@ -39,7 +107,7 @@ static Entry* findEntry(Entry* src_entry, ObjString* key, int capacity) {
             tombstone = entry;
         } else if(IS_EMPTY_ENTRY(entry)){
             return tombstone == NULL ? entry : tombstone;
-        } else if(entry->key == key) {
+        } else if(!IS_UNUSED(entry) && keysEqual(entry->key, key)) {
             return entry;
         }
         index = (index + 1) % capacity;
@@ -49,12 +117,12 @@ static Entry* findEntry(Entry* src_entry, ObjString* key, int capacity) {
 static void adjustTable(Table* table, int capacity) {
     Entry* new_entry = (Entry*)malloc(sizeof(Entry) * capacity);
     for(int i = 0; i < capacity; i++) {
-        new_entry[i].key = NULL;
+        new_entry[i].key = VALUE_UNDEFINED;
         new_entry[i].val = VALUE_NIL;
     }
     table->count = 0;
     for(int i = 0; i < table->capacity; i++) {
-        if(table->entry[i].key == NULL) {
+        if(IS_UNDEFINED(table->entry[i].key)) {
             continue;
         }
         Entry* dest = findEntry(new_entry, table->entry[i].key, capacity);
@@ -66,9 +134,12 @@ static void adjustTable(Table* table, int capacity) {
     if(table->entry) FREE(table->entry, "free entry\n");
     table->entry = new_entry;
 	table->capacity = capacity;
+    table->version++;
 }
 
-bool tableSet(Table* table, ObjString* key, Value val) {
+bool tableSetValue(Table* table, Value key, Value val) {
+    // A view is looked up by its chars, but only interned strings are stored.
+    if(IS_STRING(key)) key = VALUE_OBJ(internString(AS_STRING(key)));
     if(table->count >= table->capacity * MAX_LOAD) {
         int capacity = GROW_CAPACITY(table->capacity);
         adjustTable(table, capacity);
@@ -88,39 +159,86 @@ bool tableSet(Table* table, ObjString* key, Value val) {
     return is_new_key;
 }
 
-bool tableGet(Table* table, ObjString* key, Value* val) {
+bool tableGetValue(Table* table, Value key, Value* val) {
     if(table->count == 0) return false;
     Entry* entry = findEntry(table->entry, key, table->capacity);
-    if(entry->key == NULL) return false;
+    if(IS_UNUSED(entry)) return false;
     *val = entry->val;
     return true;
 }
 
 // Only set the entry a tombstone, not decrease the count.
-bool tableDelete(Table* table, ObjString* key) {
+bool tableDeleteValue(Table* table, Value key) {
+    if(table->count == 0) return false;
     Entry* to_be_delete = findEntry(table->entry, key, table->capacity);
-    if(to_be_delete->key == NULL) return false;
+    if(IS_UNUSED(to_be_delete)) return false;
 
     // Treat a tombstone as an normal entry, so don't reduce 'table->count'.
     SET_TOMBSTONE(to_be_delete);
+    table->version++;
     return true;
 }
 
-ObjString* tableFindString(Table* table, const char* initial, int length, uint32_t hash) {
+bool tableSet(Table* table, ObjString* key, Value val) {
+    return tableSetValue(table, VALUE_OBJ(key), val);
+}
+
+bool tableGet(Table* table, ObjString* key, Value* val) {
+    return tableGetValue(table, VALUE_OBJ(key), val);
+}
+
+bool tableDelete(Table* table, ObjString* key) {
+    return tableDeleteValue(table, VALUE_OBJ(key));
+}
+
+// Find the entry of 'key', NULL if it's not there. A hit is remembered in
+// 'cache' and reused until the table rehashes or deletes something, while
+// adding keys never moves the existing entries.
+Entry* tableGetCached(Table* table, ObjString* key, EntryCache* cache) {
+    if(cache->version == table->version) return cache->entry;
     if(table->count == 0) return NULL;
+    Entry* entry = findEntry(table->entry, VALUE_OBJ(key), table->capacity);
+    if(IS_UNUSED(entry)) return NULL;
+    cache->entry = entry;
+    cache->version = table->version;
+    return entry;
+}
+
+// Return the index of the next used entry after 'index', or -1 at the end.
+// Start the walk with -1.
+int tableNext(Table* table, int index) {
+    for(index++; index < table->capacity; index++) {
+        if(!IS_UNDEFINED(table->entry[index].key)) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Probe once for an interned string. Return its entry if it exists,
+// otherwise the entry it should be inserted at, which the caller must fill.
+Entry* tableFindOrAddString(Table* table, const char* initial, int length, uint32_t hash) {
+    if(table->count + 1 > table->capacity * MAX_LOAD) {
+        adjustTable(table, GROW_CAPACITY(table->capacity));
+    }
 
     int index = hash % table->capacity;
     Entry* tombstone = NULL;
     for(;;) {
         Entry* entry = &table->entry[index];
 
-        if(IS_TOMBSTONE(entry)) {
-            continue;
-        } else if(IS_EMPTY_ENTRY(entry)) {
-            return NULL;
-        } else if(entry->key->length == length && entry->key->hash_code == hash \
-                && strncmp(entry->key->chars, initial, length) == 0) {
-            return entry->key;
+        if(IS_EMPTY_ENTRY(entry)) {
+            if(tombstone != NULL) return tombstone;
+            table->count++;
+            return entry;
+        } else if(IS_TOMBSTONE(entry)) {
+            if(tombstone == NULL) tombstone = entry;
+        } else {
+            ObjString* key = AS_STRING(entry->key);
+            if(key->length == length && key->hash_code == hash \
+                    && memcmp(STRING_CHARS(key), initial, length) == 0) {
+                return entry;
+            }
         }
 
         index = (index + 1) % table->capacity;
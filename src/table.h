@@ -1,10 +1,12 @@
 #ifndef __TABLE_H__
 #define __TABLE_H__
 
+#include <stdint.h>
 #include "value.h"
 
+// An unused entry has an 'UNDEFINED' key.
 typedef struct {
-    ObjString* key;
+    Value key;
     Value val;
 } Entry;
 
@@ -12,14 +14,25 @@ typedef struct {
     int count;
     int capacity;
     Entry* entry;
+    uint32_t version;   // Bumped whenever entries move or get deleted.
 } Table;
 
+// An inline cache of one lookup, valid while 'version' matches the table's.
+typedef struct {
+    Entry* entry;
+    uint32_t version;
+} EntryCache;
+
 void initTable(Table* table);
 void freeTable(Table* table);
+bool tableSetValue(Table* table, Value key, Value val);
+bool tableGetValue(Table* table, Value key, Value* val);
+bool tableDeleteValue(Table* table, Value key);
 bool tableSet(Table* table, ObjString* key, Value val);
 bool tableGet(Table* table, ObjString* key, Value* val);
 bool tableDelete(Table* table, ObjString* key);
-ObjString* tableFindString(Table* table, const char* initial, int length, uint32_t hash);
+int tableNext(Table* table, int index);
+Entry* tableGetCached(Table* table, ObjString* key, EntryCache* cache);
+Entry* tableFindOrAddString(Table* table, const char* initial, int length, uint32_t hash);
 
 #endif // !__TABLE_H__
-
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -6,6 +7,7 @@
 #include "value.h"
 #include "object.h"
 #include "mem.h"
+#include "number.h"
 #include "table.h"
 #include "vm.h"
 
@@ -37,15 +39,50 @@ static void printOBJ(Value* val) {
     ObjType type = val->as.obj->type;
     switch(type) {
         case OBJ_STRING: {
-            printf("%s", AS_CSTRING(*val));
+            // A view isn't '\0' ended.
+            printf("%.*s", AS_STRING(*val)->length, AS_CSTRING(*val));
             break;
         }
         case OBJ_FUNCTION: {
-            printf("%s", AS_FUNC(*val)->func_name->chars);
+            printf("%s", STRING_CHARS(AS_FUNC(*val)->func_name));
             break;
         }
         case OBJ_CLOSURE: {
-            printf("%s", AS_CLOSURE(*val)->function->func_name->chars);
+            printf("%s", STRING_CHARS(AS_CLOSURE(*val)->function->func_name));
+            break;
+        }
+        case OBJ_UPVALUE: {
+            printf("upvalue");
+            break;
+        }
+        case OBJ_NATIVE: {
+            printf("<native %s>", STRING_CHARS(AS_NATIVE(*val)->name));
+            break;
+        }
+        case OBJ_LIST: {
+            ValueArray* items = &AS_LIST(*val)->items;
+            printf("[");
+            for(int i = 0; i < items->count; i++) {
+                printValue(&items->val[i], i == 0 ? "" : ", ", "");
+            }
+            printf("]");
+            break;
+        }
+        case OBJ_MAP: {
+            Table* table = &AS_MAP(*val)->table;
+            printf("{");
+            bool first = true;
+            for(int i = tableNext(table, -1); i != -1; i = tableNext(table, i)) {
+                printValue(&table->entry[i].key, first ? "" : ", ", ": ");
+                printValue(&table->entry[i].val, "", "");
+                first = false;
+            }
+            printf("}");
+            break;
+        }
+        case OBJ_JUMP_TABLE: {
+            printf("<jump table>");
+            break;
         }
     }
 };
@@ -54,7 +91,13 @@ void printValue(Value* val, const char* pre, const char* tail) {
     ValueType type = val->type;
     switch(type) {
         case NUMBER: {
-            printf("%s%g%s", pre, val->as.number, tail);
+            char number[NUMBER_BUFFER];
+            formatNumber(val->as.number, number);
+            printf("%s%s%s", pre, number, tail);
+            break;
+        }
+        case INT: {
+            printf("%s%" PRId64 "%s", pre, val->as.integer, tail);
             break;
         }
         case BOOLEAN: {
@@ -73,14 +116,8 @@ void printValue(Value* val, const char* pre, const char* tail) {
             printf("%s", tail);
             break;
         }
+        case UNDEFINED: {
+            break;
+        }
     }
 }
-
-static uint32_t hashString(const char* initial, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)initial[i];
-        hash *= 16777619;
-    }
-    return hash;
-}
@@ -8,31 +8,47 @@ typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjFunction ObjFunction;
 typedef struct ObjClosure ObjClosure;
+typedef struct ObjNative ObjNative;
+typedef struct ObjList ObjList;
+typedef struct ObjMap ObjMap;
+typedef struct ObjJumpTable ObjJumpTable;
 
 #define VALUE_NUMBER(value)     (Value){NUMBER, {.number=(value)}}
+#define VALUE_INT(value)        (Value){INT, {.integer=(value)}}
 #define VALUE_NIL               (Value){NIL, {.number=0}}
 #define VALUE_BOOLEAN(value)    (Value){BOOLEAN, {.boolean=(value)}}
 #define VALUE_OBJ(value)        (Value){OBJ, {.obj=(Obj*)(value)}}
+#define VALUE_UNDEFINED         (Value){UNDEFINED, {.number=0}}
 
 #define AS_NUMBER(a) (double)(a.as.number)
 #define AS_BOOLEAN(a) (bool)(a.as.boolean)
+#define AS_INT(a) (int64_t)((a).as.integer)
 
 #define IS_NUMBER(val) ((val).type == NUMBER)
 #define IS_NIL(val) ((val).type == NIL)
 #define IS_BOOLEAN(val) ((val).type == BOOLEAN)
 #define IS_OBJ(val) ((val).type == OBJ)
+#define IS_UNDEFINED(val) ((val).type == UNDEFINED)
+#define IS_INT(val) ((val).type == INT)
+#define IS_NUMERIC(val) (IS_NUMBER(val) || IS_INT(val))
+
+// Either kind of number as a double.
+#define TO_DOUBLE(val) (IS_INT(val) ? (double)(val).as.integer : (val).as.number)
 
 typedef enum {
     NIL,
     NUMBER,
     BOOLEAN,
-    OBJ
+    OBJ,
+    INT,        // Exact, a 'NUMBER' is a double.
+    UNDEFINED,  // Only marks an unused table entry, never seen by scripts.
 } ValueType;
 
 typedef struct {
     ValueType type;
     union {
         double number;
+        int64_t integer;
         bool boolean;
         Obj* obj;
     } as;
@@ -44,6 +60,27 @@ typedef struct {
     Value* val;
 } ValueArray;
 
+// Like the __builtin_*_overflow functions: true if 'a / b' isn't an exact integer.
+static inline bool divideOverflow(int64_t a, int64_t b, int64_t* res) {
+    if(b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) return true;
+    *res = a / b;
+    return false;
+}
+
+// Store 'a op b' into 'res' and evaluate to true if both are numbers.
+// Two integers stay exact through 'int_op', one of the overflow checking
+// functions above; an overflow or a mix with a double gives a double.
+#define NUMBER_OP(a, b, int_op, op, res) \
+    (IS_INT(a) && IS_INT(b) && !int_op(AS_INT(a), AS_INT(b), &(res).as.integer) \
+        ? ((res).type = INT, true) \
+        : IS_NUMERIC(a) && IS_NUMERIC(b) \
+            ? ((res) = VALUE_NUMBER(TO_DOUBLE(a) op TO_DOUBLE(b)), true) \
+            : false)
+
+// Compare two numbers, exactly if both are integers.
+#define NUMBER_COMPARE(a, b, op) \
+    (IS_INT(a) && IS_INT(b) ? AS_INT(a) op AS_INT(b) : TO_DOUBLE(a) op TO_DOUBLE(b))
+
 void initValueArray(ValueArray* value_array);
 void freeValueArray(ValueArray* value_array);
 void addOne(ValueArray* value_array, Value val);
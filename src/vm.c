@@ -11,38 +11,63 @@
 #include "compiler.h"
 #include "hint.h"
 #include "object.h"
+#include "native.h"
+#include "jit.h"
 
 VM vm;
 
 static PROCESS_RESULT runTimeError(const char* mes);
-static void addFrame(ObjClosure* closure) {
+// The arguments are already on the stack, right above the closure.
+static bool addFrame(ObjClosure* closure) {
     if(vm.frame_count == FRAME_MAX) {
-        runTimeError("The stack frame is overflox.\n");
+        return false;
     }
     CallFrames* cur = &(vm.frames[vm.frame_count]);
     cur->closures = closure;
     cur->ip = closure->function->ram.code;
     cur->slot = vm.stack_top - closure->function->arity;
     vm.frame_count++;
+    return true;
 }
 
 static CallFrames* currentFrame() {
     return &(vm.frames[vm.frame_count - 1]);
 }
 
-static Value pop();
-static void subtractFrame() {
-    int local_count = vm.stack_top - currentFrame()->slot;
-    local_count += (currentFrame()->closures->function->type == TYPE_USER ? 1 : 0);
-    for(int i = 0; i < local_count; i++) {
-        pop();
-    }
+// Drop the frame with its locals and the callee in one store, and leave
+// 'result' where the callee was.
+static void subtractFrame(Value result) {
+    CallFrames* frame = currentFrame();
+    Value* base = frame->slot - (frame->closures->function->type == TYPE_USER ? 1 : 0);
+    *base = result;
+    vm.stack_top = base + 1;
     vm.frame_count--;
 }
 
 
+static void resetStack() {
+    for(ObjUpvalue* cur = vm.open_upvalues; cur != NULL; cur = cur->next) {
+        vm.open_slot[cur->location - vm.stack] = NULL;
+    }
+    vm.stack_top = vm.stack;
+    vm.frame_count = 0;
+    vm.open_upvalues = NULL;
+}
+
+// Print the message, then a trace of every active frame from the innermost.
 static PROCESS_RESULT runTimeError(const char* mes) {
     redHint(mes);
+    for(int i = vm.frame_count - 1; i >= 0; i--) {
+        CallFrames* frame = &vm.frames[i];
+        ObjFunction* function = frame->closures->function;
+        int offset = (int)(frame->ip - function->ram.code) - 1;
+        printf("[line %d] in ", getLine(&function->ram, offset));
+        if(function->type == TYPE_MAIN) {
+            printf("script\n");
+        } else {
+            printf("%s()\n", STRING_CHARS(function->func_name));
+        }
+    }
     return RUNTIME_ERROR;
 }
 
@@ -66,23 +91,29 @@ static Value pop() {
 }
 
 void initVM() {
-    vm.frame_count = 0;
-    vm.stack_top = vm.stack;
+    resetStack();
     vm.obj_list = NULL;
     initTable(&vm.strings);
     initTable(&vm.globals);
-    vm.open_upvalues = NULL;
+    vm.print_code = true;
+    vm.lazy_compile = false;
+    vm.jit_enabled = false;
+    vm.jit_runs = 0;
+    vm.register_ops = false;
+    vm.inline_calls = false;
+    vm.inline_base = NULL;
+    defineNatives();
 }
 
-void writeCode(Ram* ram, OpCode op_code) {
-    addCode(ram, op_code);
+void writeCode(Ram* ram, OpCode op_code, int line) {
+    addCode(ram, op_code, line);
 }
 
 // Only 256 elements can be stored.
-void writeConstant(Ram* ram, Value val) {
+void writeConstant(Ram* ram, Value val, int line) {
     int index = addConstant(ram, val);
-    writeCode(ram, OP_CONSTANT);
-    writeCode(ram, index);
+    writeCode(ram, OP_CONSTANT, line);
+    writeCode(ram, index, line);
 }
 
 static void printStack() {
@@ -107,8 +138,8 @@ static void printGlobal() {
         return;
     }
     for(int i = 0; i < cur->capacity; i++) {
-        if(cur->entry[i].key != NULL) {
-            printf("[%s", cur->entry[i].key->chars);
+        if(!IS_UNDEFINED(cur->entry[i].key)) {
+            printf("[%s", AS_CSTRING(cur->entry[i].key));
             printValue(&cur->entry[i].val, ":", "], ");
         }
     }
@@ -119,60 +150,179 @@ static bool handleCondition(Value val) {
     if(IS_NUMBER(val)) {
         double tmp = AS_NUMBER(val);
         return tmp == 0 ? false : true;
+    } else if(IS_INT(val)) {
+        return AS_INT(val) != 0;
     } else if(IS_NIL(val)) {
         return false;
     }
     return AS_BOOLEAN(val);
 }
 
+// Only accept a number without fraction in [0, count).
+static bool checkIndex(Value index, int count, int* res) {
+    if(IS_INT(index)) {
+        if(AS_INT(index) < 0 || AS_INT(index) >= count) return false;
+        *res = (int)AS_INT(index);
+        return true;
+    }
+    if(!IS_NUMBER(index)) return false;
+    double num = AS_NUMBER(index);
+    // Range check first, converting NaN or a huge double is undefined.
+    if(!(num >= 0 && num < count) || num != (int)num) return false;
+    *res = (int)num;
+    return true;
+}
+
+// The remainder takes the sign of the divisor, so 'i % n' is in [0, n).
+static int64_t modulo(int64_t a, int64_t b) {
+    if(b == -1) return 0;   // INT64_MIN % -1 would trap.
+    int64_t res = a % b;
+    if(res != 0 && (res < 0) != (b < 0)) res += b;
+    return res;
+}
+
+// The offset 'OP_JUMP_TABLE' jumps by for 'val'.
+static int jumpTableTarget(ObjJumpTable* table, Value val) {
+    int index = table->default_target;
+    if(IS_NUMERIC(val) && table->dense_count > 0) {
+        double i = TO_DOUBLE(val) - table->low;
+        if(i >= 0 && i < table->dense_count && i == (int)i) {
+            return table->targets[table->dense[(int)i]];
+        }
+    }
+    Value found;
+    if(table->sparse.count > 0 && tableGetValue(&table->sparse, val, &found)) {
+        index = (int)AS_NUMBER(found);
+    }
+    return table->targets[index];
+}
+
+// Count a call or back-edge of the frame's function, compile it once it is
+// hot, and run its native code until that hands the ip back.
+static void runJit(CallFrames* frame) {
+    ObjFunction* function = frame->closures->function;
+    if(function->jit == NULL) {
+        if(function->hotness < 0 || ++function->hotness < JIT_HOT_THRESHOLD) return;
+        if(!jitCompile(function)) {
+            function->hotness = -1;
+            return;
+        }
+    }
+    vm.jit_runs++;
+    frame->ip = jitRun(function, frame->slot, frame->ip);
+}
+
+// 'vm.open_slot' finds an open upvalue by its stack slot, and the list
+// sorted by descending location lets closing stop at the first one below.
 static ObjUpvalue* captureUpvalue(Value* val) {
-    ObjUpvalue* cur = vm.open_upvalues; 
+    ObjUpvalue** open = &vm.open_slot[val - vm.stack];
+    if(*open != NULL) {
+        return *open;
+    }
+
+    // New captures are almost always in the newest frame, near the head.
+    ObjUpvalue* cur = vm.open_upvalues;
     ObjUpvalue* pre = NULL;
     while(cur != NULL && cur->location > val) {
         pre = cur;
         cur = cur->next;
     }
-    if(cur != NULL && cur->location == val) {
-        return cur;
-    }
-
     ObjUpvalue* upvalue = allocateObjUpvalue(val);
-    upvalue->next = vm.open_upvalues;
-    vm.open_upvalues = upvalue;
+    upvalue->next = cur;
+    if(pre == NULL) {
+        vm.open_upvalues = upvalue;
+    } else {
+        pre->next = upvalue;
+    }
+    *open = upvalue;
     return upvalue;
 }
 
 static void closeUpvalues(Value* last) {
-    ObjUpvalue* cur = vm.open_upvalues;
-    while (cur != NULL && cur->location >= last) {
-        ObjUpvalue* upvalue = cur;
+    while(vm.open_upvalues != NULL && vm.open_upvalues->location >= last) {
+        ObjUpvalue* upvalue = vm.open_upvalues;
+        vm.open_slot[upvalue->location - vm.stack] = NULL;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        cur = upvalue->next;
+        vm.open_upvalues = upvalue->next;
     }
 }
 
 static PROCESS_RESULT run() {
-    if(currentFrame()->ip == NULL) {
+    CallFrames* frame = currentFrame();
+    if(frame->ip == NULL) {
         printf("No executable instruction.\n");
         return COMPILE_ERROR;
     }
-#define READ_BYTE() (*(currentFrame()->ip)++)
-#define READ_CONSTANT() currentFrame()->closures->function->ram.constants.val[READ_BYTE()]
-#define BINARY_OP(op) \
+#define READ_BYTE() (*(frame->ip)++)
+#define READ_CONSTANT() frame->closures->function->ram.constants.val[READ_BYTE()]
+// The inline cache of the instruction whose operand is next.
+#define READ_CACHE() (&frame->closures->function->ram.global_cache[ \
+                        frame->ip - 1 - frame->closures->function->ram.code])
+#define BINARY_OP(int_op, op) \
     do { \
         Value b = pop(); \
         Value a = pop(); \
-        if(!IS_NUMBER(a) || !IS_NUMBER(b)) { \
+        Value res; \
+        if(!NUMBER_OP(a, b, int_op, op, res)) { \
             return runTimeError("Values both aren't 'NUMBER', can't 'BINARY_OP' them.\n"); \
         } \
-        if(push(VALUE_NUMBER(AS_NUMBER(a) op AS_NUMBER(b))) == false) { \
+        if(push(res) == false) { \
             runTimeError("The stack is overflow.\n"); \
         } \
     } while(0)
 
+// Operators only defined on integers.
+#define INT_OP(name, expr) \
+    do { \
+        Value b = pop(); \
+        Value a = pop(); \
+        if(!IS_INT(a) || !IS_INT(b)) { \
+            return runTimeError("Values both aren't 'INT', can't '" name "' them.\n"); \
+        } \
+        int64_t x = AS_INT(a); \
+        int64_t y = AS_INT(b); \
+        if(push(VALUE_INT(expr)) == false) { \
+            return runTimeError("The stack is overflow.\n"); \
+        } \
+    } while(0)
+
+#define LOCAL_OPERAND() frame->slot[READ_BYTE()]
+// Numbers are done in place, anything else is pushed
+// and handed to the stack form of the operator.
+#define REGISTER_FALLBACK(generic, a, b) \
+    do { \
+        if(push(a) == false || push(b) == false) { \
+            return runTimeError("The stack is overflow.\n"); \
+        } \
+        instruction = generic; \
+        goto dispatch; \
+    } while(0)
+
+#define REGISTER_OP(generic, operand, int_op, op) \
+    do { \
+        Value a = LOCAL_OPERAND(); \
+        Value b = operand; \
+        Value res; \
+        if(!NUMBER_OP(a, b, int_op, op, res)) REGISTER_FALLBACK(generic, a, b); \
+        if(push(res) == false) { \
+            return runTimeError("The stack is overflow.\n"); \
+        } \
+    } while(0)
+
+#define REGISTER_COMPARE(generic, operand, op) \
+    do { \
+        Value a = LOCAL_OPERAND(); \
+        Value b = operand; \
+        if(!IS_NUMERIC(a) || !IS_NUMERIC(b)) REGISTER_FALLBACK(generic, a, b); \
+        if(push(VALUE_BOOLEAN(NUMBER_COMPARE(a, b, op))) == false) { \
+            return runTimeError("The stack is overflow.\n"); \
+        } \
+    } while(0)
+
     for(;;) {
         uint8_t instruction = READ_BYTE();
+dispatch:
         switch(instruction) {
             case OP_CONSTANT: {
                 Value val = READ_CONSTANT();
@@ -204,6 +354,11 @@ static PROCESS_RESULT run() {
             }
             case OP_NEGATE: {
                 Value* tmp = vm.stack_top - 1;
+                if(IS_INT(*tmp)) {
+                    *tmp = AS_INT(*tmp) == INT64_MIN ? VALUE_NUMBER(-(double)INT64_MIN)
+                                                     : VALUE_INT(-AS_INT(*tmp));
+                    break;
+                }
                 if(!IS_NUMBER(*tmp)) {
                     return runTimeError("The value isn't a 'NUMBER', can't 'OP_NEGATE' it.\n");
                 }
@@ -229,21 +384,25 @@ static PROCESS_RESULT run() {
                 Value b = pop();
                 Value a = pop();
                 if(IS_STRING(a) && IS_STRING(b)) {
-                    // strcat
-                    char* str1 = AS_CSTRING(a);
-                    int length1 = strlen(str1);
-                    char* str2 = AS_CSTRING(b);
-                    int length2 = strlen(str2);
-                    int length = length1 + length2;
-                    char total_str[length + 1];
-                    strncpy(total_str, str1, length1);
-                    strncpy(total_str + length1, str2, length2);
+                    // A short result is built on the stack and copied inline,
+                    // a long one is built in its final buffer and taken.
+                    ObjString* str1 = AS_STRING(a);
+                    ObjString* str2 = AS_STRING(b);
+                    int length = str1->length + str2->length;
+                    char short_str[STRING_INLINE_MAX + 1];
+                    char* total_str = length <= STRING_INLINE_MAX ? short_str : (char*)malloc(length + 1);
+                    memcpy(total_str, STRING_CHARS(str1), str1->length);
+                    memcpy(total_str + str1->length, STRING_CHARS(str2), str2->length);
                     total_str[length] = '\0';
-                    if(push(allocateString(total_str, length)) == false) {
+                    ObjString* res = length <= STRING_INLINE_MAX ? allocateObjString(total_str, length) \
+                                                                 : takeObjString(total_str, length);
+                    if(push(VALUE_OBJ(res)) == false) {
                         return runTimeError("The stack is overflow.\n");
                     }
-                } else if(IS_NUMBER(a) && IS_NUMBER(b)) {
-                    if(push(VALUE_NUMBER(AS_NUMBER(a) + AS_NUMBER(b))) == false) {
+                } else if(IS_NUMERIC(a) && IS_NUMERIC(b)) {
+                    Value res;
+                    NUMBER_OP(a, b, __builtin_add_overflow, +, res);
+                    if(push(res) == false) {
                         return runTimeError("The stack is overflow.\n");
                     }
                 } else {
@@ -252,27 +411,63 @@ static PROCESS_RESULT run() {
                 break;
             }
             case OP_SUBTRACT: {
-                BINARY_OP(-);
+                BINARY_OP(__builtin_sub_overflow, -);
                 break;
             }
             case OP_MULTIPLY: {
-                BINARY_OP(*);
+                BINARY_OP(__builtin_mul_overflow, *);
                 break;
             }
             case OP_DIVIDE: {
-                BINARY_OP(/);
+                BINARY_OP(divideOverflow, /);
+                break;
+            }
+            case OP_MODULO: {
+                if(IS_INT(vm.stack_top[-1]) && AS_INT(vm.stack_top[-1]) == 0) {
+                    return runTimeError("Can't 'OP_MODULO' by zero.\n");
+                }
+                INT_OP("OP_MODULO", modulo(x, y));
+                break;
+            }
+            case OP_BIT_AND: {
+                INT_OP("OP_BIT_AND", x & y);
+                break;
+            }
+            case OP_BIT_OR: {
+                INT_OP("OP_BIT_OR", x | y);
+                break;
+            }
+            case OP_BIT_XOR: {
+                INT_OP("OP_BIT_XOR", x ^ y);
+                break;
+            }
+            case OP_SHIFT_LEFT: {
+                // The count is taken modulo 64, bits shifted out are lost.
+                INT_OP("OP_SHIFT_LEFT", (int64_t)((uint64_t)x << (y & 63)));
+                break;
+            }
+            case OP_SHIFT_RIGHT: {
+                INT_OP("OP_SHIFT_RIGHT", x >> (y & 63));
+                break;
+            }
+            case OP_BIT_NOT: {
+                Value* tmp = vm.stack_top - 1;
+                if(!IS_INT(*tmp)) {
+                    return runTimeError("The value isn't an 'INT', can't 'OP_BIT_NOT' it.\n");
+                }
+                tmp->as.integer = ~tmp->as.integer;
                 break;
             }
             case OP_EQUAL: {
                 Value b = pop();
                 Value a = pop();
                 bool res;
-                if(IS_NUMBER(a) && IS_NUMBER(b)) {
-                    res = (AS_NUMBER(a) == AS_NUMBER(b));
+                if(IS_NUMERIC(a) && IS_NUMERIC(b)) {
+                    res = NUMBER_COMPARE(a, b, ==);
                 } else if(IS_BOOLEAN(a) && IS_BOOLEAN(b)) {
                     res = (AS_BOOLEAN(a) == AS_BOOLEAN(b));
                 } else if(IS_STRING(a) && IS_STRING(b)) {
-                    res = (AS_STRING(a) == AS_STRING(b));
+                    res = stringsEqual(AS_STRING(a), AS_STRING(b));
                 } else if(IS_NIL(a) && IS_NIL(b)) {
                     res = true;
                 } else {
@@ -286,10 +481,10 @@ static PROCESS_RESULT run() {
             case OP_GREATER: {
                 Value b = pop();
                 Value a = pop();
-                if(!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                if(!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
                     return runTimeError("values both aren't NUMBER, can't 'OP_GREATER' them.\n");
                 }
-                if(push(VALUE_BOOLEAN(AS_NUMBER(a) > AS_NUMBER(b))) == false) {
+                if(push(VALUE_BOOLEAN(NUMBER_COMPARE(a, b, >))) == false) {
                     return runTimeError("The stack is overflow.\n");
                 }
                 break;
@@ -297,10 +492,10 @@ static PROCESS_RESULT run() {
             case OP_LESS: {
                 Value b = pop();
                 Value a = pop();
-                if(!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                if(!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
                     return runTimeError("values both aren't NUMBER, can't 'OP_LESS' them.\n");
                 }
-                if(push(VALUE_BOOLEAN(AS_NUMBER(a) < AS_NUMBER(b))) == false) {
+                if(push(VALUE_BOOLEAN(NUMBER_COMPARE(a, b, <))) == false) {
                     return runTimeError("The stack is overflow.\n");
                 }
                 break;
@@ -317,102 +512,370 @@ static PROCESS_RESULT run() {
                 break;
             }
             case OP_GET_GLOBAL: {
+                EntryCache* cache = READ_CACHE();
                 Value key = READ_CONSTANT();
-                Value val;
-                if(!tableGet(&vm.globals, AS_STRING(key), &val)) {
+                Entry* entry = tableGetCached(&vm.globals, AS_STRING(key), cache);
+                if(entry == NULL) {
                     return runTimeError("Not find the global variable.\n");
                 };
-                if(push(val) == false) {
+                if(push(entry->val) == false) {
                     return runTimeError("The stack is overflow.\n");
                 }
                 break;
             }
             case OP_SET_GLOBAL: {
+                EntryCache* cache = READ_CACHE();
                 Value key = READ_CONSTANT();
-                Value val = pop();
-                if(tableSet(&vm.globals, AS_STRING(key), val)) {
-                    tableDelete(&vm.globals, AS_STRING(key));
+                Entry* entry = tableGetCached(&vm.globals, AS_STRING(key), cache);
+                if(entry == NULL) {
                     return runTimeError("Can't find the variable name.\n");
                 }
-                if(push(val) == false) {
-                    return runTimeError("The stack is overflow.\n");
-                }
+                // The value stays on the stack.
+                entry->val = *(vm.stack_top - 1);
                 break;
             }
             case OP_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                if(push(currentFrame()->slot[slot]) == false) {
+                if(push(frame->slot[slot]) == false) {
                     return runTimeError("The stack is overflow.\n");
                 }
                 break;
             }
             case OP_SET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                Value* val = &(currentFrame()->slot[slot]);
+                Value* val = &(frame->slot[slot]);
                 *val = pop();
                 if(push(*val) == false) {
                     return runTimeError("The stack is overflow.\n");
                 }
                 break;
             }
+            case OP_ADD_LL: {
+                REGISTER_OP(OP_ADD, LOCAL_OPERAND(), __builtin_add_overflow, +);
+                break;
+            }
+            case OP_SUBTRACT_LL: {
+                REGISTER_OP(OP_SUBTRACT, LOCAL_OPERAND(), __builtin_sub_overflow, -);
+                break;
+            }
+            case OP_MULTIPLY_LL: {
+                REGISTER_OP(OP_MULTIPLY, LOCAL_OPERAND(), __builtin_mul_overflow, *);
+                break;
+            }
+            case OP_DIVIDE_LL: {
+                REGISTER_OP(OP_DIVIDE, LOCAL_OPERAND(), divideOverflow, /);
+                break;
+            }
+            case OP_EQUAL_LL: {
+                REGISTER_COMPARE(OP_EQUAL, LOCAL_OPERAND(), ==);
+                break;
+            }
+            case OP_GREATER_LL: {
+                REGISTER_COMPARE(OP_GREATER, LOCAL_OPERAND(), >);
+                break;
+            }
+            case OP_LESS_LL: {
+                REGISTER_COMPARE(OP_LESS, LOCAL_OPERAND(), <);
+                break;
+            }
+            case OP_ADD_LC: {
+                REGISTER_OP(OP_ADD, READ_CONSTANT(), __builtin_add_overflow, +);
+                break;
+            }
+            case OP_SUBTRACT_LC: {
+                REGISTER_OP(OP_SUBTRACT, READ_CONSTANT(), __builtin_sub_overflow, -);
+                break;
+            }
+            case OP_MULTIPLY_LC: {
+                REGISTER_OP(OP_MULTIPLY, READ_CONSTANT(), __builtin_mul_overflow, *);
+                break;
+            }
+            case OP_DIVIDE_LC: {
+                REGISTER_OP(OP_DIVIDE, READ_CONSTANT(), divideOverflow, /);
+                break;
+            }
+            case OP_EQUAL_LC: {
+                REGISTER_COMPARE(OP_EQUAL, READ_CONSTANT(), ==);
+                break;
+            }
+            case OP_GREATER_LC: {
+                REGISTER_COMPARE(OP_GREATER, READ_CONSTANT(), >);
+                break;
+            }
+            case OP_LESS_LC: {
+                REGISTER_COMPARE(OP_LESS, READ_CONSTANT(), <);
+                break;
+            }
+            case OP_STORE_LOCAL: {
+                uint8_t slot = READ_BYTE();
+                frame->slot[slot] = pop();
+                break;
+            }
             case OP_JUMP_IF_FALSE: {
                 Value condition = *(vm.stack_top - 1);
                 // Value condition = pop();
                 uint8_t low_bits = READ_BYTE();
                 uint8_t high_bits = READ_BYTE();
                 if(handleCondition(condition) == false) {
-                    currentFrame()->ip += (uint16_t)((high_bits << 8) + low_bits);
+                    frame->ip += (uint16_t)((high_bits << 8) + low_bits);
+                }
+                break;
+            }
+            case OP_JUMP_IF_TRUE: {
+                Value condition = *(vm.stack_top - 1);
+                uint8_t low_bits = READ_BYTE();
+                uint8_t high_bits = READ_BYTE();
+                if(handleCondition(condition) == true) {
+                    frame->ip += (uint16_t)((high_bits << 8) + low_bits);
                 }
                 break;
             }
             case OP_JUMP: {
                 uint8_t low_bits = READ_BYTE();
                 uint8_t high_bits = READ_BYTE();
-                currentFrame()->ip += (uint16_t)((high_bits << 8) + low_bits);
+                frame->ip += (uint16_t)((high_bits << 8) + low_bits);
                 break;
             }
             case OP_BACK_JUMP: {
                 uint8_t low_bits = READ_BYTE();
                 uint8_t high_bits = READ_BYTE();
-                currentFrame()->ip -= (uint16_t)((high_bits << 8) + low_bits);
+                frame->ip -= (uint16_t)((high_bits << 8) + low_bits);
+                // 'while' and C-style 'for' loops come back here.
+                if(vm.jit_enabled) runJit(frame);
+                break;
+            }
+            case OP_FOR_PREP: {
+                // The counter is in 'slot', the limit right after it.
+                Value* counter = &(frame->slot[READ_BYTE()]);
+                uint8_t low_bits = READ_BYTE();
+                uint8_t high_bits = READ_BYTE();
+                if(!IS_NUMERIC(counter[0]) || !IS_NUMERIC(counter[1])) {
+                    return runTimeError("The range bounds both aren't 'NUMBER'.\n");
+                }
+                if(!NUMBER_COMPARE(counter[0], counter[1], <)) {
+                    frame->ip += (uint16_t)((high_bits << 8) + low_bits);
+                }
+                break;
+            }
+            case OP_FOR_ITER: {
+                Value* counter = &(frame->slot[READ_BYTE()]);
+                uint8_t low_bits = READ_BYTE();
+                uint8_t high_bits = READ_BYTE();
+                // The limit is hidden, but the body may assign the counter.
+                if(IS_INT(counter[0])) {
+                    if(__builtin_add_overflow(AS_INT(counter[0]), 1, &counter[0].as.integer)) {
+                        counter[0] = VALUE_NUMBER((double)INT64_MAX + 1);
+                    }
+                } else if(IS_NUMBER(counter[0])) {
+                    counter[0].as.number += 1;
+                } else {
+                    return runTimeError("The loop counter isn't a 'NUMBER'.\n");
+                }
+                if(NUMBER_COMPARE(counter[0], counter[1], <)) {
+                    frame->ip -= (uint16_t)((high_bits << 8) + low_bits);
+                    if(vm.jit_enabled) runJit(frame);
+                }
+                break;
+            }
+            case OP_JUMP_TABLE: {
+                ObjJumpTable* table = AS_JUMP_TABLE(READ_CONSTANT());
+                frame->ip += jumpTableTarget(table, pop());
                 break;
             }
             case OP_CALL: {
                 uint8_t arg_num = READ_BYTE();
                 Value* call_func = vm.stack_top - arg_num - 1;
-                if(!IS_CLOSURE(*call_func)) {
-                    return runTimeError("The value can't be called.\n");
+                // Closures first, they are the common case.
+                if(IS_CLOSURE(*call_func)) {
+                    ObjClosure* closure = AS_CLOSURE(*call_func);
+                    ObjFunction* function = closure->function;
+                    if(arg_num != function->arity) {
+                        return runTimeError("The number of parameters is wrong.\n");
+                    }
+                    if(function->lazy != NULL && !compileLazy(function)) {
+                        return runTimeError("The function body can't be compiled.\n");
+                    }
+                    if(!addFrame(closure)) {
+                        return runTimeError("The stack frame is overflow.\n");
+                    }
+                    frame = currentFrame();
+                    if(vm.jit_enabled) runJit(frame);
+                    break;
+                }
+                if(IS_NATIVE(*call_func)) {
+                    ObjNative* native = AS_NATIVE(*call_func);
+                    if(arg_num != native->arity) {
+                        return runTimeError("The number of parameters is wrong.\n");
+                    }
+                    if(!native->function(call_func + 1, call_func)) {
+                        return runTimeError("The arguments of the native function are wrong.\n");
+                    }
+                    vm.stack_top = call_func + 1;
+                    break;
+                }
+                return runTimeError("The value can't be called.\n");
+            }
+            case OP_INLINE_CHECK: {
+                ObjFunction* function = AS_FUNC(READ_CONSTANT());
+                uint8_t low_bits = READ_BYTE();
+                uint8_t high_bits = READ_BYTE();
+                Value* callee = vm.stack_top - function->arity - 1;
+                if(IS_CLOSURE(*callee) && AS_CLOSURE(*callee)->function == function) {
+                    // Not saved: 'inlineLength' keeps calls and other
+                    // inline bodies out of the body run from here.
+                    vm.inline_base = callee + 1;
+                } else {
+                    frame->ip += (uint16_t)((high_bits << 8) + low_bits);
                 }
-                ObjClosure* closure = (AS_CLOSURE(*call_func));
-                if(arg_num != closure->function->arity) {
-                    return runTimeError("The number of parameters is wrong.\n");
+                break;
+            }
+            case OP_GET_ARG: {
+                if(push(vm.inline_base[READ_BYTE()]) == false) {
+                    return runTimeError("The stack is overflow.\n");
                 }
-                addFrame(closure);
+                break;
+            }
+            case OP_SET_ARG: {
+                vm.inline_base[READ_BYTE()] = *(vm.stack_top - 1);
+                break;
+            }
+            case OP_INLINE_RETURN: {
+                // Like 'OP_RETURN': the result replaces the callee,
+                // then skip the 'OP_CALL' kept for a failed check.
+                vm.inline_base[-1] = *(vm.stack_top - 1);
+                vm.stack_top = vm.inline_base;
+                frame->ip += 2;
                 break;
             }
             case OP_CLOSURE: {
-                ObjClosure* closure = allocateObjClosure((ObjFunction*)(READ_CONSTANT().as.obj));
+                ObjFunction* function = AS_FUNC(READ_CONSTANT());
+                if(function->upvalue_count == 0) {
+                    // Nothing is captured, so every evaluation shares one closure.
+                    if(function->shared_closure == NULL) {
+                        function->shared_closure = allocateObjClosure(function, 0);
+                    }
+                    if(push(VALUE_OBJ(function->shared_closure)) == false) {
+                        return runTimeError("The stack is overflow.\n");
+                    }
+                    break;
+                }
+                int copy_count = 0;
+                for(int i = 0; i < function->upvalue_count; i++) {
+                    copy_count += frame->ip[2 * i] == CAPTURE_COPY;
+                }
+                ObjClosure* closure = allocateObjClosure(function, copy_count);
                 push(VALUE_OBJ(closure));
+                ObjUpvalue* copy = closure->copies;
                 for(int i = 0; i < closure->function->upvalue_count; i++) {
-                    int is_local = READ_BYTE();
+                    int kind = READ_BYTE();
                     int index = READ_BYTE();
-                    if(is_local) {
-                        closure->upvalues[i] = captureUpvalue(currentFrame()->slot + index);
+                    if(kind == CAPTURE_COPY) {
+                        copy->obj.type = OBJ_UPVALUE;
+                        copy->closed = frame->slot[index];
+                        copy->location = &copy->closed;
+                        copy->next = NULL;
+                        closure->upvalues[i] = copy++;
+                    } else if(kind == CAPTURE_LOCAL) {
+                        closure->upvalues[i] = captureUpvalue(frame->slot + index);
                     } else {
-                        closure->upvalues[i] = currentFrame()->closures->upvalues[index];
+                        closure->upvalues[i] = frame->closures->upvalues[index];
                     }
                 }
                 break;
             }
+            case OP_LIST: {
+                uint8_t capacity = READ_BYTE();
+                if(push(VALUE_OBJ(allocateObjList(capacity))) == false) {
+                    return runTimeError("The stack is overflow.\n");
+                }
+                break;
+            }
+            case OP_APPEND: {
+                Value val = pop();
+                Value list = *(vm.stack_top - 1);
+                if(!IS_LIST(list)) {
+                    return runTimeError("The value isn't a 'LIST', can't 'OP_APPEND' to it.\n");
+                }
+                addOne(&AS_LIST(list)->items, val);
+                break;
+            }
+            case OP_MAP: {
+                if(push(VALUE_OBJ(allocateObjMap())) == false) {
+                    return runTimeError("The stack is overflow.\n");
+                }
+                break;
+            }
+            case OP_INSERT: {
+                Value val = pop();
+                Value key = pop();
+                Value map = *(vm.stack_top - 1);
+                if(!IS_MAP(map)) {
+                    return runTimeError("The value isn't a 'MAP', can't 'OP_INSERT' to it.\n");
+                }
+                tableSetValue(&AS_MAP(map)->table, key, val);
+                break;
+            }
+            case OP_GET_INDEX: {
+                Value index = pop();
+                Value list = pop();
+                if(IS_MAP(list)) {
+                    Value val;
+                    if(!tableGetValue(&AS_MAP(list)->table, index, &val)) {
+                        return runTimeError("The key isn't in the map.\n");
+                    }
+                    push(val);
+                    break;
+                }
+                if(IS_STRING(list)) {
+                    ObjString* str = AS_STRING(list);
+                    int i;
+                    if(!checkIndex(index, str->length, &i)) {
+                        return runTimeError("The index is out of the string.\n");
+                    }
+                    push(VALUE_OBJ(sliceObjString(str, i, 1)));
+                    break;
+                }
+                if(!IS_LIST(list)) {
+                    return runTimeError("The value can't be indexed.\n");
+                }
+                ValueArray* items = &AS_LIST(list)->items;
+                int i;
+                if(!checkIndex(index, items->count, &i)) {
+                    return runTimeError("The index is out of the list.\n");
+                }
+                push(items->val[i]);
+                break;
+            }
+            case OP_SET_INDEX: {
+                Value val = pop();
+                Value index = pop();
+                Value list = pop();
+                if(IS_MAP(list)) {
+                    tableSetValue(&AS_MAP(list)->table, index, val);
+                    push(val);
+                    break;
+                }
+                if(!IS_LIST(list)) {
+                    return runTimeError("The value can't be indexed.\n");
+                }
+                ValueArray* items = &AS_LIST(list)->items;
+                int i;
+                if(!checkIndex(index, items->count, &i)) {
+                    return runTimeError("The index is out of the list.\n");
+                }
+                items->val[i] = val;
+                push(val);
+                break;
+            }
             case OP_GET_UPVALUE: {
                 int index = READ_BYTE();
-                push(*(currentFrame()->closures->upvalues[index]->location));
+                push(*(frame->closures->upvalues[index]->location));
                 break;
             }
             case OP_SET_UPVALUE: {
                 Value val = pop();
                 int index = READ_BYTE();
-                *(currentFrame()->closures->upvalues[index]->location) = val;
+                *(frame->closures->upvalues[index]->location) = val;
                 break;
             }
             case OP_POP: {
@@ -425,14 +888,15 @@ static PROCESS_RESULT run() {
                 break;
             }
             case OP_RETURN: {
-                Value return_value = pop();
-                closeUpvalues(currentFrame()->slot);
-                if(vm.frame_count > 1) {
-                    subtractFrame();
-                    push(return_value);
-                    break;
+                Value return_value = *(vm.stack_top - 1);
+                closeUpvalues(frame->slot);
+                if(vm.frame_count == 1) {
+                    vm.stack_top--;
+                    return INTERPRET_OK;
                 }
-                return INTERPRET_OK;
+                subtractFrame(return_value);
+                frame = currentFrame();
+                break;
             }
         }
         // printStack();
@@ -473,19 +937,29 @@ static void vmStateCheck() {
     }
 }
 
-PROCESS_RESULT interpret(const char* source) {
-    initVM();
-
-    ObjFunction* main_func = compile(source);
+// Compile 'source' as a new top-level chunk and run it. Globals and
+// interned strings are kept between calls, so call initVM() only once.
+PROCESS_RESULT interpret(const char* source, size_t length) {
+    ObjFunction* main_func = compile(source, length);
     if(main_func == NULL) {
         return COMPILE_ERROR;
     }
 
-    addFrame(allocateObjClosure(main_func));
+    addFrame(allocateObjClosure(main_func, 0));
     PROCESS_RESULT res = run();
-    disassembleFunction(currentFrame()->closures->function);
-    subtractFrame();
-    disassembleAll();
+    if(res != INTERPRET_OK) {
+        resetStack();
+        return res;
+    }
+    if(vm.print_code) {
+        disassembleFunction(currentFrame()->closures->function);
+    }
+    // The script has no callee slot, only its locals are left.
+    vm.stack_top = currentFrame()->slot;
+    vm.frame_count--;
+    if(vm.print_code) {
+        disassembleAll();
+    }
     vmStateCheck();
 
     return res;
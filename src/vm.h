@@ -1,6 +1,8 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "object.h"
@@ -25,7 +27,15 @@ typedef struct {
     Obj* obj_list;
     Table strings;  // Use hash table as a 'set'.
     Table globals;
-    ObjUpvalue* open_upvalues;
+    ObjUpvalue* open_upvalues;  // Sorted by descending stack location.
+    ObjUpvalue* open_slot[STACK_MAX];   // The open upvalue of each stack slot.
+    bool print_code;    // Disassemble every function after a run.
+    bool lazy_compile;  // Compile function bodies on their first call.
+    bool jit_enabled;   // Compile hot functions to native code.
+    long jit_runs;      // Times native code was entered.
+    bool register_ops;  // Fuse local operands into register-form opcodes.
+    bool inline_calls;  // Splice small leaf functions into their callers.
+    Value* inline_base; // Slot 0 of the body being run inline.
 } VM;
 
 typedef enum {
@@ -34,6 +44,11 @@ typedef enum {
     COMPILE_ERROR
 } PROCESS_RESULT;
 
+// How 'OP_CLOSURE' gets each upvalue, the byte before its index.
+#define CAPTURE_UPVALUE 0   // Share an upvalue of the enclosing closure.
+#define CAPTURE_LOCAL   1   // Capture a local of the frame, open until its scope ends.
+#define CAPTURE_COPY    2   // Copy a local that is never assigned again.
+
 typedef enum {
     OP_CONSTANT,
     OP_NIL,
@@ -51,6 +66,32 @@ typedef enum {
     OP_GREATER,
     OP_LESS,
 
+    // Register forms of the operators above, in the same order. They read
+    // two locals ('_LL') or a local and a constant ('_LC') and are only
+    // emitted with --reg, together with 'OP_STORE_LOCAL'.
+    OP_ADD_LL,
+    OP_SUBTRACT_LL,
+    OP_MULTIPLY_LL,
+    OP_DIVIDE_LL,
+    OP_EQUAL_LL,
+    OP_GREATER_LL,
+    OP_LESS_LL,
+    OP_ADD_LC,
+    OP_SUBTRACT_LC,
+    OP_MULTIPLY_LC,
+    OP_DIVIDE_LC,
+    OP_EQUAL_LC,
+    OP_GREATER_LC,
+    OP_LESS_LC,
+    OP_STORE_LOCAL,     // Pop into a local, 'OP_SET_LOCAL' + 'OP_POP'.
+    OP_MODULO,          // Integer only, like the bitwise operators.
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_BIT_NOT,
+
     OP_PRINT,
     OP_DEFINE_GLOBAL,
     OP_GET_GLOBAL,
@@ -61,12 +102,31 @@ typedef enum {
     OP_GET_UPVALUE,
 
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
     OP_JUMP,
     OP_BACK_JUMP,
+    OP_FOR_PREP,
+    OP_FOR_ITER,
+    OP_JUMP_TABLE,
 
     OP_CLOSURE,
+
+    OP_LIST,
+    OP_APPEND,
+    OP_MAP,
+    OP_INSERT,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
     
     OP_CALL,
+    // A leaf function spliced into its caller by --inline: the check falls
+    // through when the callee is still that function, or jumps to a real
+    // 'OP_CALL' right after 'OP_INLINE_RETURN', which skips it. The body
+    // reaches the callee's locals through 'inline_base'.
+    OP_INLINE_CHECK,
+    OP_GET_ARG,
+    OP_SET_ARG,
+    OP_INLINE_RETURN,
     OP_POP,
     OP_CLOSE_UPVALUE,
 
@@ -74,10 +134,10 @@ typedef enum {
 } OpCode;
 
 void initVM();
-PROCESS_RESULT interpret(const char* source);
+PROCESS_RESULT interpret(const char* source, size_t length);
 void freeVM();
-void writeCode(Ram* ram, OpCode op_code);
-void writeConstant(Ram* ram, Value val);
+void writeCode(Ram* ram, OpCode op_code, int line);
+void writeConstant(Ram* ram, Value val, int line);
 
 #endif // !__VM_H__
 
@@ -0,0 +1,11 @@
+#!/bin/sh
+# A hot 'while' loop in a single call, so only its back-edges can make
+# it hot, must be compiled and run as native code.
+# usage: test/jit_while.sh <path to clox>
+CLOX=${1:-./clox}
+DIR=$(dirname "$0")
+OUT=$("$CLOX" --jit-stats "$DIR/jit_while.lox" 2>&1 | grep -a '^[0-9]\|^jit_runs=')
+echo "$OUT" | grep -qx '49995000' || { echo "FAIL: wrong result"; echo "$OUT"; exit 1; }
+RUNS=$(echo "$OUT" | sed -n 's/^jit_runs=//p')
+[ "${RUNS:-0}" -ge 1 ] || { echo "FAIL: native code never ran"; exit 1; }
+echo "ok jit_runs=$RUNS"
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Run every test/*.lox that has a .out under each combination of --lazy,
+# --jit, --reg and --inline, then the shell tests. The disassembly the
+# interpreter prints is filtered out before comparing.
+# usage: test/run.sh <path to clox>
+CLOX=${1:-./clox}
+DIR=$(dirname "$0")
+FAIL=0
+for lox in "$DIR"/*.lox; do
+    out="${lox%.lox}.out"
+    [ -f "$out" ] || continue
+    for lazy in "" --lazy; do for jit in "" --jit; do
+    for reg in "" --reg; do for inline in "" --inline; do
+        flags="$lazy $jit $reg $inline"
+        if ! "$CLOX" $flags "$lox" 2>&1 | grep -av '\*\*\*\*\|^.\[1;31m[0-9][0-9][0-9][0-9]' | diff -q - "$out" >/dev/null; then
+            echo "FAIL: $lox [$(echo $flags)]"
+            FAIL=1
+        fi
+    done; done; done; done
+done
+for sh in "$DIR"/*.sh; do
+    [ "$sh" = "$DIR/run.sh" ] && continue
+    sh "$sh" "$CLOX" >/dev/null || { echo "FAIL: $sh"; FAIL=1; }
+done
+[ $FAIL -eq 0 ] && echo "ok"
+exit $FAIL